@@ -0,0 +1,33 @@
+#ifndef ALLOC_COUNTER_H_
+#define ALLOC_COUNTER_H_
+
+/*
+Counts heap allocations made through operator new, to check that frames in
+a steady state don't allocate.
+
+Linking alloc_counter.cpp replaces the global operator new of the program,
+so it is only meant for test and benchmark builds. Memory OpenCV allocates
+for its matrices does not go through operator new and is not counted.
+*/
+namespace alloc_counter
+{
+    /*
+    Allocations since the start of the program, from all threads
+    */
+    long count();
+
+    /*
+    Allocations made while an instance is alive
+    */
+    class scope
+    {
+    public:
+        scope();
+        long allocations() const;
+
+    private:
+        long start;
+    };
+}
+
+#endif // ALLOC_COUNTER_H_
@@ -0,0 +1,16 @@
+#include <cstdlib>
+
+#include "compare.hpp"
+
+int main(int argc, char *argv[])
+{
+    // Make sure we were given an username to test against
+    if (argc < 2)
+    {
+        exit(12);
+    }
+
+    // Load the models from scratch, there's no daemon to borrow them from
+    recognition_models recognition;
+    compare(argv[1], recognition);
+}
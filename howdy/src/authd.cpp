@@ -0,0 +1,320 @@
+#include <sys/syslog.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include <opencv2/core/utils/logger.hpp>
+
+#include <INIReader.h>
+
+#include "compare.hpp"
+#include "models.hpp"
+#include "utils.hpp"
+#include "authd_protocol.hpp"
+
+#include "utils/string.hpp"
+
+namespace fs = std::filesystem;
+
+// Connections handled at the same time, more wait in the listen backlog
+const int MAX_CLIENTS = 8;
+
+// Taken by the process running an attempt, so only one uses the camera
+const auto CAMERA_LOCK_PATH = "/run/howdy/authd.lock";
+
+/*Read a request up to the terminating empty line, giving up after AUTHD_REQUEST_TIMEOUT*/
+bool read_request(int fd, std::string &username, std::vector<std::string> &env)
+{
+    std::string request;
+    char buffer[512];
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(AUTHD_REQUEST_TIMEOUT);
+
+    while (request.find("\n\n") == std::string::npos)
+    {
+        // The deadline covers the whole request, a client sending a byte at a time can't stretch it
+        int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0)
+            return false;
+
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0 || request.size() + n > AUTHD_MAX_REQUEST)
+            return false;
+
+        request.append(buffer, n);
+    }
+
+    std::vector<std::string> lines = split(request.substr(0, request.find("\n\n")), "\n");
+    if (lines.empty())
+        return false;
+
+    username = lines[0];
+    env.assign(lines.begin() + 1, lines.end());
+    return true;
+}
+
+/*Only root and the user itself may ask to check a face for an account*/
+bool is_allowed(int fd, const struct passwd *pw)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+        return false;
+
+    return cred.uid == 0 || cred.uid == pw->pw_uid;
+}
+
+/*Point the auth ui at the Wayland session of the user, without trusting paths from the client*/
+void set_session_env(const struct passwd *pw, const std::vector<std::string> &env)
+{
+    // The runtime directory follows from the account, not from the request
+    std::string runtime_dir = "/run/user/" + std::to_string(pw->pw_uid);
+    struct stat info;
+    if (stat(runtime_dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != pw->pw_uid)
+        return;
+
+    setenv("XDG_RUNTIME_DIR", runtime_dir.c_str(), 1);
+
+    for (auto &var : env)
+    {
+        std::vector<std::string> pair = split(var, "=", 1);
+        for (auto name : AUTHD_FORWARDED_ENV)
+        {
+            // Only a socket name inside the runtime directory
+            if (pair.size() == 2 && pair[0] == name && !pair[1].empty() && pair[1].find('/') == std::string::npos)
+                setenv(name, pair[1].c_str(), 1);
+        }
+    }
+}
+
+/*True if the client closed its end of the connection*/
+bool client_gone(int fd)
+{
+    struct pollfd pfd = {fd, POLLRDHUP, 0};
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+/*Send the status of an accepted request, a client that went away is only logged*/
+void send_status(int fd, int status)
+{
+    if (write(fd, &status, sizeof(status)) != sizeof(status))
+        syslog(LOG_ERR, "Failed to send the result, client went away");
+}
+
+/*Refuse a request, with the status the client should report*/
+void refuse(int fd, int status)
+{
+    char state = AUTHD_REFUSED;
+    if (write(fd, &state, 1) != 1)
+        syslog(LOG_ERR, "Failed to send the result, client went away");
+    else
+        send_status(fd, status);
+}
+
+/*Serve one connection, runs in its own process so a slow client can't hold up the others*/
+void handle_client(int fd, recognition_models &recognition)
+{
+    std::string username;
+    std::vector<std::string> env;
+
+    if (!read_request(fd, username, env))
+    {
+        syslog(LOG_ERR, "Received a malformed or incomplete request");
+        refuse(fd, W_EXITCODE(12, 0));
+        return;
+    }
+
+    struct passwd *pw = getpwnam(username.c_str());
+    if (!pw || !is_allowed(fd, pw))
+    {
+        syslog(LOG_ERR, "Refused request for user %s from another account", username.c_str());
+        refuse(fd, W_EXITCODE(12, 0));
+        return;
+    }
+
+    // From here on the client must not start an attempt of its own
+    char state = AUTHD_ACCEPTED;
+    if (write(fd, &state, 1) != 1)
+        return;
+
+    // There's only one camera, so attempts run one at a time. Every handler
+    // opens the lock itself, flock is shared between forks of one descriptor
+    int lock_fd = open(CAMERA_LOCK_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0)
+    {
+        syslog(LOG_ERR, "Can't lock the camera: %s (%d)", strerror(errno), errno);
+        // The accepted byte went out already, only the status follows
+        send_status(fd, W_EXITCODE(1, 0));
+        return;
+    }
+
+    // Nobody is waiting for an attempt anymore
+    if (client_gone(fd))
+    {
+        syslog(LOG_INFO, "Client for user %s went away while waiting for the camera", username.c_str());
+        return;
+    }
+
+    pid_t child_pid = fork();
+    if (child_pid < 0)
+    {
+        syslog(LOG_ERR, "Can't fork the compare process: %s (%d)", strerror(errno), errno);
+        send_status(fd, W_EXITCODE(1, 0));
+        return;
+    }
+
+    if (child_pid == 0)
+    {
+        // The child only talks to the camera and the ui, not to the socket
+        close(fd);
+        signal(SIGPIPE, SIG_DFL);
+        closelog();
+
+        // Let the auth ui find the session of the user
+        set_session_env(pw, env);
+
+        compare(username, recognition);
+    }
+
+    int status;
+    waitpid(child_pid, &status, 0);
+    send_status(fd, status);
+}
+
+/*Load the models again before a request if the config changed their settings, the children inherit them*/
+void refresh_models(recognition_models &recognition, fs::file_time_type &config_time)
+{
+    std::error_code error;
+    fs::file_time_type modified = fs::last_write_time(PATH + "/config.ini", error);
+    if (error || modified == config_time)
+        return;
+    config_time = modified;
+
+    INIReader config(PATH + "/config.ini");
+    if (config.ParseError() != 0)
+    {
+        syslog(LOG_ERR, "Failed to parse the configuration file: %d, keeping the loaded models", config.ParseError());
+        return;
+    }
+
+    // Does nothing unless the detector settings changed, and only switches the encoder engine
+    recognition.load(detector_config::read(config), config.GetBoolean("core", "int8_encoder", false));
+    std::chrono::duration<double> load_time = recognition.load_time();
+    if (load_time.count() > 0)
+        syslog(LOG_INFO, "Configuration changed, models reloaded in %.2fs", load_time.count());
+}
+
+int main(int argc, char *argv[])
+{
+    cv::utils::logging::setLogLevel(cv::utils::logging::LOG_LEVEL_SILENT);
+
+    openlog("howdy-authd", LOG_PID, LOG_AUTHPRIV);
+
+    // Read config from disk, changes are picked up before the next request
+    std::error_code error;
+    fs::file_time_type config_time = fs::last_write_time(PATH + "/config.ini", error);
+    INIReader config(PATH + "/config.ini");
+
+    // Error out if we could not read the config file
+    if (config.ParseError() != 0)
+    {
+        syslog(LOG_ERR, "Failed to parse the configuration file: %d", config.ParseError());
+        exit(1);
+    }
+
+    if (!fs::is_regular_file(fs::status(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat")))
+    {
+        syslog(LOG_ERR, "Data files have not been downloaded");
+        exit(1);
+    }
+
+    // Load the models once, every request after this gets them for free
+    recognition_models recognition;
+    recognition.load(detector_config::read(config), config.GetBoolean("core", "int8_encoder", false));
+    // The loading threads have to be done before anything gets forked
+    recognition.wait();
+
+    // Clients that hang up early should not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+    {
+        syslog(LOG_ERR, "Can't create the socket: %s (%d)", strerror(errno), errno);
+        exit(1);
+    }
+
+    // Replace the socket of a previous run
+    fs::create_directories(fs::path(AUTHD_SOCKET_PATH).parent_path());
+    unlink(AUTHD_SOCKET_PATH);
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, AUTHD_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 4) != 0)
+    {
+        syslog(LOG_ERR, "Can't listen on %s: %s (%d)", AUTHD_SOCKET_PATH, strerror(errno), errno);
+        exit(1);
+    }
+
+    // Screen lockers run PAM as the user, so everyone has to be able to connect
+    chmod(AUTHD_SOCKET_PATH, 0666);
+
+    syslog(LOG_INFO, "Models loaded, listening on %s", AUTHD_SOCKET_PATH);
+
+    // Every connection is served by its own process, so one that never sends
+    // its request can't keep the others waiting
+    int clients = 0;
+    while (true)
+    {
+        // Collect the handlers that are done, wait for one if all are busy
+        while (clients > 0 && waitpid(-1, nullptr, clients >= MAX_CLIENTS ? 0 : WNOHANG) > 0)
+            clients--;
+
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EINTR)
+                syslog(LOG_ERR, "Failed to accept a connection: %s (%d)", strerror(errno), errno);
+            continue;
+        }
+
+        // Reloading here keeps it out of every child, they get the models on fork
+        refresh_models(recognition, config_time);
+
+        pid_t handler_pid = fork();
+        if (handler_pid < 0)
+        {
+            syslog(LOG_ERR, "Can't fork a handler: %s (%d)", strerror(errno), errno);
+            close(fd);
+            continue;
+        }
+
+        if (handler_pid == 0)
+        {
+            close(listen_fd);
+            handle_client(fd, recognition);
+            close(fd);
+            _exit(0);
+        }
+
+        clients++;
+        close(fd);
+    }
+}
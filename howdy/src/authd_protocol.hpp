@@ -0,0 +1,43 @@
+#ifndef AUTHD_PROTOCOL_H_
+#define AUTHD_PROTOCOL_H_
+
+/*
+Shared between howdy-authd and the PAM module, keep this header free of
+anything that needs more than C++14.
+
+A request is the username on the first line, followed by any number of
+KEY=VALUE lines with environment variables for the auth ui, and ends with an
+empty line. The daemon answers with a single byte, AUTHD_ACCEPTED once it has
+taken the request or AUTHD_REFUSED if it won't run it, followed by the wait
+status of the compare run as a native int.
+
+Once a request is accepted the daemon owns the attempt. A client that loses
+the connection after that must not start an attempt of its own, the camera
+may still be in use by the daemon.
+*/
+
+// The socket howdy-authd listens on
+const auto AUTHD_SOCKET_PATH = "/run/howdy/authd.sock";
+
+// Longest request the daemon will read
+const auto AUTHD_MAX_REQUEST = 4096;
+
+// First byte of every answer
+const char AUTHD_ACCEPTED = 'A';
+const char AUTHD_REFUSED = 'R';
+
+// How long either side waits for the other to send the request or the first
+// byte of the answer, in milliseconds
+const auto AUTHD_REQUEST_TIMEOUT = 2000;
+
+// Added to the video timeout when waiting for the result of an accepted
+// request, covers loading, waiting for an earlier attempt and rubberstamps
+const auto AUTHD_RESULT_MARGIN = 30;
+
+// Session variables passed on to the auth ui. Only the name of the Wayland
+// socket is taken from the client, the daemon looks for it in the runtime
+// directory of the user being authenticated. X11 paths and displays are not
+// forwarded, as the auth ui runs as root.
+const char *const AUTHD_FORWARDED_ENV[] = {"WAYLAND_DISPLAY"};
+
+#endif // AUTHD_PROTOCOL_H_
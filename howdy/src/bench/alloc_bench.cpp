@@ -0,0 +1,201 @@
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <INIReader.h>
+
+#define FMT_HEADER_ONLY
+#include "../fmt/core.h"
+
+#include "../alloc_counter.hpp"
+#include "../models.hpp"
+#include "../utils.hpp"
+
+/*
+Counts the heap allocations of detection, landmarks and encoding per frame
+once the workspaces of the models have been sized by the first frames.
+
+    howdy-alloc-bench [--save-baseline file | --baseline file] [frame image]
+
+The frame should show a face, the way the camera sees it. Without one a
+gray test frame is used, with a made up face box for the later stages.
+
+The workspaces the wrappers keep between frames, the upsampled pyramid
+levels of the detector and the chips and network outputs of the encoder,
+must not allocate at all. They are counted on their own and the bench fails
+if they do. With the int8 engine the network runs on dlib's thread pool,
+which allocates its tasks, so only the float network is held to that.
+
+The rest happens inside dlib: the feature pyramid of the HOG scanner, the
+CNN detectors, the landmark predictor and the vectors the APIs return by
+value. Those counts depend on the dlib version, the models and the frame,
+so they are checked against a baseline measured on the same setup.
+--save-baseline writes the counts of this run to a file, --baseline fails
+if a stage allocates more than the file says.
+*/
+
+// Frames to size the workspaces, and frames to count
+const int WARMUP_FRAMES = 3;
+const int COUNTED_FRAMES = 20;
+
+/*Counts per frame by stage, as written by --save-baseline*/
+std::map<std::string, double> read_baseline(const std::string &path)
+{
+    std::map<std::string, double> counts;
+    std::ifstream file(path);
+    std::string stage;
+    double count;
+    while (file >> stage >> count)
+        counts[stage] = count;
+    return counts;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string save_path, baseline_path, frame_path;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--save-baseline" && i + 1 < argc)
+            save_path = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baseline_path = argv[++i];
+        else
+            frame_path = arg;
+    }
+
+    cv::Mat frame;
+    if (!frame_path.empty())
+    {
+        frame = cv::imread(frame_path, cv::IMREAD_GRAYSCALE);
+        if (frame.empty())
+        {
+            std::cerr << "Could not read " << frame_path << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        frame = cv::Mat(480, 640, CV_8UC1);
+        cv::randu(frame, 0, 256);
+        cv::GaussianBlur(frame, frame, cv::Size(9, 9), 0);
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baseline_path.empty())
+    {
+        baseline = read_baseline(baseline_path);
+        if (baseline.empty())
+        {
+            std::cerr << "Could not read the baseline " << baseline_path << std::endl;
+            return 1;
+        }
+    }
+
+    INIReader config(PATH + "/config.ini");
+    std::unique_ptr<face_detection_model> detector = make_face_detector(detector_config::read(config));
+    shape_predictor_model predictor(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat");
+    face_recognition_model_v1 encoder(PATH + "/dlib-data/dlib_face_recognition_resnet_model_v1.dat");
+    encoder.use_int8(config.GetBoolean("core", "int8_encoder", false));
+    bool float_network = encoder.engine().rfind("float", 0) == 0;
+
+    // Totals over the counted frames
+    long upsampling = 0, workspaces = 0;
+    long detection = 0, landmarks = 0, encoding = 0;
+    size_t faces_found = 0;
+    std::vector<full_object_detection> shapes;
+    for (int i = 0; i < WARMUP_FRAMES + COUNTED_FRAMES; i++)
+    {
+        bool counted = i >= WARMUP_FRAMES;
+
+        // A new context every frame, like the pipeline does. Its RGB version
+        // belongs to the frame, not to the models
+        image_context context(frame);
+        if (!detector->reads_gray())
+            context.rgb();
+
+        alloc_counter::scope upsample_scope;
+        detector->upsample(context, 1);
+        if (counted)
+            upsampling += upsample_scope.allocations();
+
+        alloc_counter::scope detect_scope;
+        std::vector<rectangle> faces = (*detector)(context, 0);
+        if (counted)
+            detection += detect_scope.allocations();
+
+        faces_found = faces.size();
+        if (faces.empty())
+            faces.push_back(centered_rect(point(frame.cols / 2, frame.rows / 2), frame.rows / 2, frame.rows / 2));
+
+        alloc_counter::scope landmark_scope;
+        shapes.clear();
+        for (const rectangle &face : faces)
+            shapes.push_back(predictor(context, face));
+        if (counted)
+            landmarks += landmark_scope.allocations();
+
+        alloc_counter::scope workspace_scope;
+        encoder.encode_faces(context, shapes, 1);
+        if (counted)
+            workspaces += workspace_scope.allocations();
+
+        alloc_counter::scope encode_scope;
+        std::vector<matrix<double, 0, 1>> descriptors = encoder.compute_face_descriptors(context, shapes, 1);
+        if (counted)
+            encoding += encode_scope.allocations();
+    }
+
+    std::cout << fmt::format("Faces in the frame: {}, encoder: {}", faces_found, encoder.engine()) << std::endl;
+
+    bool ok = true;
+    std::cout << "Allocations per frame in the workspaces, have to be 0" << std::endl;
+    std::cout << fmt::format("  Upsampling: {:.1f}", double(upsampling) / COUNTED_FRAMES) << std::endl;
+    ok &= upsampling == 0;
+    std::cout << fmt::format("  Chips and network outputs: {:.1f}{}", double(workspaces) / COUNTED_FRAMES, float_network ? "" : " (not checked with int8)") << std::endl;
+    ok &= !float_network || workspaces == 0;
+
+    std::vector<std::pair<std::string, long>> stages{
+        {"detection", detection},
+        {"landmarks", landmarks},
+        {"encoding", encoding},
+    };
+
+    std::cout << "Allocations per frame inside dlib" << std::endl;
+    std::ofstream saved;
+    if (!save_path.empty())
+        saved.open(save_path, std::ios::trunc);
+    for (const auto &[stage, total] : stages)
+    {
+        double per_frame = double(total) / COUNTED_FRAMES;
+        std::string limit;
+        if (!baseline.empty())
+        {
+            auto found = baseline.find(stage);
+            bool over = found == baseline.end() || per_frame > found->second;
+            limit = found == baseline.end() ? ", not in the baseline" : fmt::format(" of {:.1f}{}", found->second, over ? ", over the baseline" : "");
+            ok &= !over;
+        }
+        std::cout << fmt::format("  {}: {:.1f}{}", stage, per_frame, limit) << std::endl;
+
+        if (saved.is_open())
+            saved << stage << " " << per_frame << std::endl;
+    }
+
+    if (!save_path.empty())
+    {
+        if (!saved)
+        {
+            std::cerr << "Could not write the baseline to " << save_path << std::endl;
+            return 1;
+        }
+        std::cout << "Baseline saved to " << save_path << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
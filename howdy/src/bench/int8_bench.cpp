@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dlib/image_io.h>
+#include <dlib/image_transforms.h>
+
+#define FMT_HEADER_ONLY
+#include "../fmt/core.h"
+
+#include "../int8_encoder_kernels.hpp"
+#include "../models.hpp"
+#include "../utils.hpp"
+
+/*
+Calibrates the int8 engine of the face encoder, or reports how far its
+descriptors are from the float network and how fast both are.
+
+    howdy-int8-bench calibrate <chips...>
+    howdy-int8-bench [chips...]
+
+Chips are aligned 150x150 face images, like the ones dlib's get_face_chip
+makes. Calibration needs real faces, ideally a few dozen taken with the IR
+camera in use. The report falls back to random chips if none are given,
+which only says something about the speed.
+
+Before the report, every integer kernel the CPU can run is checked against
+dot_scalar on random columns and filters of the sizes the network uses.
+*/
+
+using clock_type = std::chrono::steady_clock;
+
+// Differences a tenth of the usual matching threshold of 0.35 or more can change results
+const double DRIFT_LIMIT = 0.035;
+
+/*Milliseconds per chip for encoding the chips a few times, one at a time or all together*/
+double time_per_chip(face_recognition_model_v1 &encoder, const std::vector<matrix<rgb_pixel>> &chips, bool batched)
+{
+    const int rounds = 5;
+
+    auto start = clock_type::now();
+    for (int i = 0; i < rounds; i++)
+    {
+        if (batched)
+        {
+            encoder.batch_compute_face_descriptors_from_aligned_images(chips, 1);
+        }
+        else
+        {
+            for (const auto &chip : chips)
+                encoder.compute_face_descriptor_from_aligned_image(chip, 1);
+        }
+    }
+
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count() / (rounds * chips.size());
+}
+
+/*Whether every kernel gives exactly the sums of dot_scalar, prints the first one that doesn't*/
+bool check_kernels()
+{
+    // Filters and padded filter lengths of the quantized layers
+    const std::pair<int, int> shapes[] = {{32, 288}, {64, 576}, {128, 1152}, {256, 2304}};
+    const int columns = 64;
+
+    dlib::rand rnd(7);
+    for (const auto &[filters, length] : shapes)
+    {
+        std::vector<int8_t> weights(size_t(filters) * length);
+        std::vector<uint8_t> column(length);
+        std::vector<int32_t> expected(filters), sums(filters);
+
+        for (int c = 0; c < columns; c++)
+        {
+            // The first column has the extreme values, where 16 bit sums would overflow first
+            for (auto &weight : weights)
+                weight = c == 0 ? 127 : int(rnd.get_integer(255)) - 127;
+            for (auto &value : column)
+                value = c == 0 ? 127 : rnd.get_integer(128);
+
+            int8_kernels::dot_scalar(column.data(), weights.data(), filters, length, expected.data());
+            for (const int8_kernels::kernel &kernel : int8_kernels::supported())
+            {
+                kernel.dot(column.data(), weights.data(), filters, length, sums.data());
+                if (sums != expected)
+                {
+                    std::cerr << fmt::format("The {} kernel differs from dot_scalar with {} filters of {} values", kernel.name, filters, length) << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool calibrate = argc > 1 && std::string(argv[1]) == "calibrate";
+
+    std::vector<matrix<rgb_pixel>> chips;
+    for (int i = calibrate ? 2 : 1; i < argc; i++)
+    {
+        matrix<rgb_pixel> image, chip(150, 150);
+        load_image(image, argv[i]);
+        resize_image(image, chip);
+        chips.push_back(chip);
+    }
+
+    face_recognition_model_v1 encoder(PATH + "/dlib-data/dlib_face_recognition_resnet_model_v1.dat");
+
+    if (calibrate)
+    {
+        if (chips.empty())
+        {
+            std::cerr << "Calibration needs face chips" << std::endl;
+            return 1;
+        }
+
+        if (!encoder.calibrate_int8(chips))
+        {
+            std::cerr << "Could not calibrate the int8 engine, see the system log" << std::endl;
+            return 1;
+        }
+
+        std::cout << fmt::format("Calibrated on {} chips", chips.size()) << std::endl;
+        return 0;
+    }
+
+    if (!check_kernels())
+        return 1;
+
+    if (chips.empty())
+    {
+        dlib::rand rnd(1);
+        for (int i = 0; i < 16; i++)
+        {
+            matrix<rgb_pixel> chip(150, 150);
+            for (auto &pixel : chip)
+                pixel = rgb_pixel(rnd.get_random_8bit_number(), rnd.get_random_8bit_number(), rnd.get_random_8bit_number());
+            chips.push_back(chip);
+        }
+    }
+
+    encoder.use_int8(false);
+    std::vector<matrix<double, 0, 1>> reference = encoder.batch_compute_face_descriptors_from_aligned_images(chips, 1);
+    double float_single = time_per_chip(encoder, chips, false);
+    double float_batch = time_per_chip(encoder, chips, true);
+
+    if (!encoder.use_int8(true))
+    {
+        std::cerr << "The int8 engine is not available, run sudo howdy calibrate first" << std::endl;
+        return 1;
+    }
+    std::vector<matrix<double, 0, 1>> quantized = encoder.batch_compute_face_descriptors_from_aligned_images(chips, 1);
+    double int8_single = time_per_chip(encoder, chips, false);
+    double int8_batch = time_per_chip(encoder, chips, true);
+
+    // How far every descriptor moved, and how much the distances between chips changed
+    std::vector<double> drift;
+    double worst_pair = 0;
+    for (size_t i = 0; i < chips.size(); i++)
+    {
+        drift.push_back(length(reference[i] - quantized[i]));
+        for (size_t j = i + 1; j < chips.size(); j++)
+            worst_pair = std::max(worst_pair, std::abs(length(reference[i] - reference[j]) - length(quantized[i] - quantized[j])));
+    }
+    std::sort(drift.begin(), drift.end());
+    double mean = 0;
+    for (double d : drift)
+        mean += d / drift.size();
+
+    std::cout << fmt::format("Chips: {}, kernel: {}", chips.size(), int8_encoder::instruction_set()) << std::endl;
+    std::cout << std::endl
+              << "Descriptor drift from the float network" << std::endl;
+    std::cout << fmt::format("  Mean: {:.4f}", mean) << std::endl;
+    std::cout << fmt::format("  Median: {:.4f}", drift[drift.size() / 2]) << std::endl;
+    std::cout << fmt::format("  Largest: {:.4f}", drift.back()) << std::endl;
+    std::cout << fmt::format("  Largest change of a distance between two chips: {:.4f}", worst_pair) << std::endl;
+    std::cout << std::endl
+              << "Encoding time per chip" << std::endl;
+    std::cout << fmt::format("  Float: {:.2f} ms alone, {:.2f} ms in a batch", float_single, float_batch) << std::endl;
+    std::cout << fmt::format("  Int8: {:.2f} ms alone ({:.2f}x), {:.2f} ms in a batch ({:.2f}x)",
+                             int8_single, float_single / int8_single, int8_batch, float_batch / int8_batch)
+              << std::endl;
+
+    return std::max(drift.back(), worst_pair) < DRIFT_LIMIT ? 0 : 1;
+}
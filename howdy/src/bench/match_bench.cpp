@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#define FMT_HEADER_ONLY
+#include "../fmt/core.h"
+
+#include "../descriptor_matcher.hpp"
+#include "../descriptor_matcher_kernels.hpp"
+
+/*
+Measures the cost of matching one query against 10, 1 000 and 100 000
+stored descriptors, for the vectorized matcher and for the double precision
+loop compare used before it. Every kernel the CPU can run has to find the
+same match as that loop first.
+*/
+
+using clock_type = std::chrono::steady_clock;
+
+// Keeps the optimizer from dropping the work
+volatile float sink;
+
+/*The way compare matched before, one temporary per stored descriptor*/
+descriptor_match match_reference(const float *descriptors, size_t count, const float *query)
+{
+    std::vector<double> matches;
+    for (size_t row = 0; row < count; row++)
+    {
+        double sum = 0;
+        for (int i = 0; i < DESCRIPTOR_SIZE; i++)
+        {
+            double diff = double(descriptors[row * DESCRIPTOR_SIZE + i]) - query[i];
+            sum += diff * diff;
+        }
+        matches.push_back(std::sqrt(sum));
+    }
+
+    size_t index = std::distance(matches.begin(), std::min_element(matches.begin(), matches.end()));
+    return {index, float(matches[index])};
+}
+
+/*Run fn until at least 200ms have passed and return the time per call in ns*/
+template <typename F>
+double time_per_call(F fn)
+{
+    size_t calls = 0;
+    auto start = clock_type::now();
+    auto elapsed = clock_type::duration::zero();
+
+    while (elapsed < std::chrono::milliseconds(200))
+    {
+        for (int i = 0; i < 8; i++)
+            sink = fn().distance;
+        calls += 8;
+        elapsed = clock_type::now() - start;
+    }
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+}
+
+int main(int argc, char *argv[])
+{
+    std::mt19937 rng(42);
+    std::normal_distribution<float> value(0, 0.1);
+
+    std::cout << "Instruction set: " << descriptor_matcher::instruction_set() << std::endl
+              << std::endl;
+    std::cout << fmt::format("{:>12} {:>14} {:>14} {:>9}", "descriptors", "matcher ns", "reference ns", "speedup") << std::endl;
+
+    for (size_t count : {size_t(10), size_t(1000), size_t(100000)})
+    {
+        // Aligned the same way the model store lays them out
+        size_t bytes = count * DESCRIPTOR_SIZE * sizeof(float);
+        float *descriptors = static_cast<float *>(std::aligned_alloc(64, (bytes + 63) / 64 * 64));
+        std::generate(descriptors, descriptors + count * DESCRIPTOR_SIZE, [&] { return value(rng); });
+
+        alignas(64) float query[DESCRIPTOR_SIZE];
+        std::generate(query, query + DESCRIPTOR_SIZE, [&] { return value(rng); });
+
+        descriptor_matcher matcher(descriptors, count);
+
+        // All kernels have to agree with the reference before their speed means anything
+        descriptor_match slow = match_reference(descriptors, count, query);
+        for (const matcher_kernels::kernel &kernel : matcher_kernels::supported())
+        {
+            descriptor_match fast = kernel.match(descriptors, count, query);
+            fast.distance = std::sqrt(fast.distance);
+            if (fast.index != slow.index || std::abs(fast.distance - slow.distance) > 1e-4)
+            {
+                std::cerr << fmt::format("Mismatch of the {} kernel at {} descriptors: {} ({}) vs {} ({})", kernel.name, count, fast.index, fast.distance, slow.index, slow.distance) << std::endl;
+                return 1;
+            }
+        }
+
+        double matcher_ns = time_per_call([&] { return matcher.best_match(query); });
+        double reference_ns = time_per_call([&] { return match_reference(descriptors, count, query); });
+
+        std::cout << fmt::format("{:>12} {:>14.1f} {:>14.1f} {:>8.1f}x", count, matcher_ns, reference_ns, reference_ns / matcher_ns) << std::endl;
+
+        std::free(descriptors);
+    }
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <opencv2/imgproc.hpp>
+
+#define FMT_HEADER_ONLY
+#include "../fmt/core.h"
+
+#include "../descriptor_matcher.hpp"
+#include "../frame_preprocessor.hpp"
+#include "../models.hpp"
+#include "../utils.hpp"
+
+/*
+Times the kernels every frame goes through, one at a time, on synthetic
+frames, so changes to them can be measured without a camera or a face.
+
+    howdy-microbench [filter]
+
+Only the cases with the filter in their name are run. Every case is run once
+to warm up, then until it has taken MIN_TIME and at least MIN_CALLS calls.
+The median and the fastest call are reported, and the median per item for
+cases that work on several faces or descriptors at once.
+
+The frames are blurred noise, so the detectors find nothing and the landmark
+predictor and the encoder are given made up face boxes. That does not change
+how long they take, but detection times with a real face in the frame are a
+bit higher.
+*/
+
+using clock_type = std::chrono::steady_clock;
+
+const auto MIN_TIME = std::chrono::milliseconds(300);
+const size_t MIN_CALLS = 5;
+
+// Keeps the optimizer from dropping the work
+volatile size_t sink;
+
+std::string filter;
+
+/*Times fn and prints a line for it, items is the number of things one call works on*/
+template <typename F>
+void run(const std::string &name, size_t items, F fn)
+{
+    if (name.find(filter) == std::string::npos)
+        return;
+
+    fn();
+
+    std::vector<double> calls;
+    auto start = clock_type::now();
+    while (clock_type::now() - start < MIN_TIME || calls.size() < MIN_CALLS)
+    {
+        auto call_start = clock_type::now();
+        fn();
+        calls.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - call_start).count());
+    }
+
+    std::sort(calls.begin(), calls.end());
+    double median = calls[calls.size() / 2];
+    std::cout << fmt::format("{:<40}{:>8}{:>14.1f}{:>14.1f}{:>14.2f}", name, calls.size(), median, calls.front(), median / items) << std::endl;
+}
+
+/*Blurred noise, smooth enough to look a bit like a camera frame*/
+cv::Mat synthetic_frame(int width, int height, int type)
+{
+    cv::Mat frame(height, width, type);
+    cv::randu(frame, 0, 256);
+    cv::GaussianBlur(frame, frame, cv::Size(9, 9), 0);
+    return frame;
+}
+
+/*Square face boxes of side size, laid out in a grid over the frame*/
+std::vector<rectangle> face_grid(const cv::Mat &frame, size_t count, long size)
+{
+    long columns = std::max(1L, long(frame.cols / size));
+    std::vector<rectangle> boxes;
+    for (size_t i = 0; i < count; i++)
+    {
+        long left = long(i) % columns * size;
+        long top = std::min(long(i) / columns * size, std::max(0L, frame.rows - size));
+        boxes.push_back(rectangle(left, top, left + size - 1, top + size - 1));
+    }
+    return boxes;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        filter = argv[1];
+
+    // The same frames and descriptors every run
+    cv::setRNGSeed(42);
+    std::mt19937 rng(42);
+    const std::vector<cv::Size> resolutions{{320, 240}, {640, 480}, {1280, 720}};
+
+    std::cout << fmt::format("{:<40}{:>8}{:>14}{:>14}{:>14}", "Case", "Calls", "Median us", "Fastest us", "Per item us") << std::endl;
+
+    // Frames from the camera into the RGB image dlib works on
+    for (cv::Size size : resolutions)
+    {
+        for (int type : {CV_8UC1, CV_8UC3})
+        {
+            cv::Mat frame = synthetic_frame(size.width, size.height, type);
+            matrix<rgb_pixel> rgb;
+            run(fmt::format("convert_image {}x{} {}", size.width, size.height, type == CV_8UC1 ? "gray" : "bgr"), 1, [&] {
+                convert_image(frame, rgb);
+                sink = rgb.size();
+            });
+        }
+    }
+
+    // What add does to every gray frame
+    auto clahe = cv::createCLAHE(2.0, cv::Size(8, 8));
+    for (cv::Size size : resolutions)
+    {
+        cv::Mat frame = synthetic_frame(size.width, size.height, CV_8UC1);
+        cv::Mat enhanced, hist;
+        run(fmt::format("clahe + calcHist {}x{}", size.width, size.height), 1, [&] {
+            clahe->apply(frame, enhanced);
+            cv::calcHist(std::vector<cv::Mat>{enhanced}, std::vector<int>{0}, cv::Mat(), hist, std::vector<int>{8}, std::vector<float>{0, 256});
+            sink = hist.total();
+        });
+    }
+
+    // A camera frame until it is ready for the detector, the way it was done
+    // at full size and with frame_preprocessor, scaled down to 320 high
+    for (cv::Size size : {cv::Size(1280, 720), cv::Size(1920, 1080)})
+    {
+        for (int type : {CV_8UC1, CV_8UC3})
+        {
+            cv::Mat raw = synthetic_frame(size.width, size.height, type);
+            double scaling_factor = 320.0 / size.height;
+            const char *type_name = type == CV_8UC1 ? "gray" : "bgr";
+
+            cv::Mat gray, enhanced_full, hist;
+            run(fmt::format("full size preprocess {}x{} {}", size.width, size.height, type_name), 1, [&] {
+                cv::Mat frame, gsframe;
+                if (type == CV_8UC1)
+                    gray = raw;
+                else
+                    cv::cvtColor(raw, gray, cv::COLOR_BGR2GRAY);
+                clahe->apply(gray, enhanced_full);
+                cv::calcHist(std::vector<cv::Mat>{enhanced_full}, std::vector<int>{0}, cv::Mat(), hist, std::vector<int>{8}, std::vector<float>{0, 256});
+                cv::resize(raw, frame, cv::Size(), scaling_factor, scaling_factor, cv::INTER_AREA);
+                cv::resize(enhanced_full, gsframe, cv::Size(), scaling_factor, scaling_factor, cv::INTER_AREA);
+                sink = gsframe.total() + size_t(hist.at<float>(0));
+            });
+
+            frame_preprocessor preprocessor(scaling_factor, clahe);
+            run(fmt::format("frame_preprocessor {}x{} {}", size.width, size.height, type_name), 1, [&] {
+                // Released every call like the pipeline does, so the buffers are reused
+                cv::Mat frame, gsframe;
+                sink = size_t(preprocessor.measure(raw));
+                preprocessor.enhance(raw, frame, gsframe);
+                sink = gsframe.total();
+            });
+
+            // What a frame costs that is dropped as dark, by the bound or by measuring
+            run(fmt::format("dark_bound {}x{} {}", size.width, size.height, type_name), 1, [&] {
+                sink = size_t(preprocessor.dark_bound(raw));
+            });
+            run(fmt::format("measure {}x{} {}", size.width, size.height, type_name), 1, [&] {
+                sink = size_t(preprocessor.measure(raw));
+            });
+        }
+    }
+
+    // The detectors on a frame scaled down to max_height, the CNN ones only if their model is there
+    cv::Mat small_frame = synthetic_frame(320, 240, CV_8UC1);
+    bool have_cnn = std::filesystem::is_regular_file(PATH + "/dlib-data/mmod_human_face_detector.dat");
+    for (detector_config::mode_type mode : {detector_config::hog, detector_config::cnn, detector_config::cascade})
+    {
+        if (mode != detector_config::hog && !have_cnn)
+            continue;
+
+        detector_config settings;
+        settings.mode = mode;
+        std::unique_ptr<face_detection_model> detector = make_face_detector(settings);
+        const char *mode_name = mode == detector_config::hog ? "hog" : mode == detector_config::cnn ? "cnn" : "cascade";
+
+        for (int upsample : {0, 1, 2})
+        {
+            run(fmt::format("detect {} 320x240 upsample {}", mode_name, upsample), 1, [&] {
+                sink = (*detector)(small_frame, upsample).size();
+            });
+        }
+    }
+
+    // Landmarks and descriptors on a full size color frame
+    cv::Mat frame = synthetic_frame(640, 480, CV_8UC3);
+    shape_predictor_model predictor(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat");
+    std::vector<rectangle> boxes = face_grid(frame, 16, 120);
+
+    run("shape_predictor 640x480", 1, [&] {
+        sink = predictor(frame, boxes[0]).num_parts();
+    });
+
+    std::vector<full_object_detection> landmarks;
+    for (const rectangle &box : boxes)
+        landmarks.push_back(predictor(frame, box));
+
+    face_recognition_model_v1 encoder(PATH + "/dlib-data/dlib_face_recognition_resnet_model_v1.dat");
+    std::vector<std::string> engines{"float"};
+    if (encoder.use_int8(true))
+        engines.push_back("int8");
+
+    for (const std::string &engine : engines)
+    {
+        encoder.use_int8(engine == "int8");
+        for (size_t batch : {size_t(1), size_t(4), size_t(16)})
+        {
+            std::vector<full_object_detection> faces(landmarks.begin(), landmarks.begin() + batch);
+            run(fmt::format("compute_face_descriptors {} batch {}", engine, batch), batch, [&] {
+                sink = encoder.compute_face_descriptors(frame, faces, 1).size();
+            });
+        }
+    }
+
+    // Matching a face against the descriptors of every stored model
+    std::normal_distribution<float> value(0, 0.1);
+    for (size_t count : {size_t(1), size_t(10), size_t(100), size_t(1000), size_t(10000)})
+    {
+        // Aligned the same way the model store lays them out
+        size_t bytes = count * DESCRIPTOR_SIZE * sizeof(float);
+        float *descriptors = static_cast<float *>(std::aligned_alloc(64, (bytes + 63) / 64 * 64));
+        std::generate(descriptors, descriptors + count * DESCRIPTOR_SIZE, [&] { return value(rng); });
+
+        alignas(64) float query[DESCRIPTOR_SIZE];
+        std::generate(query, query + DESCRIPTOR_SIZE, [&] { return value(rng); });
+
+        descriptor_matcher matcher(descriptors, count);
+        run(fmt::format("best_match {} descriptors {}", count, descriptor_matcher::instruction_set()), count, [&] {
+            sink = matcher.best_match(query).index;
+        });
+
+        std::free(descriptors);
+    }
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#define FMT_HEADER_ONLY
+#include "../fmt/core.h"
+
+#include "../v4l2_capture.hpp"
+
+/*
+Reads frames from a camera with the v4l2 recording plugin and then with
+OpenCV, and compares the time it takes to get a gray frame and the
+brightness both see.
+
+    howdy-v4l2-bench <device> [frames]
+
+Works with a v4l2loopback device fed a fixed picture, so it can run
+without a camera, for example:
+
+    modprobe v4l2loopback devices=1 video_nr=42 exclusive_caps=1
+    ffmpeg -re -loop 1 -i face.png -vf format=gray -f v4l2 /dev/video42
+*/
+
+using clock_type = std::chrono::steady_clock;
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: howdy-v4l2-bench <device> [frames]" << std::endl;
+        return 1;
+    }
+
+    std::string device = argv[1];
+    int frames = argc > 2 ? std::stoi(argv[2]) : 100;
+
+    // Through the driver's buffers
+    v4l2_capture capture;
+    if (!capture.open(device, -1, -1))
+    {
+        std::cerr << "Could not open " << device << " with the v4l2 plugin, see the system log" << std::endl;
+        return 1;
+    }
+
+    cv::Mat gray;
+    double v4l2_luma = 0;
+    auto start = clock_type::now();
+    for (int i = 0; i < frames; i++)
+    {
+        if (!capture.read(gray))
+        {
+            std::cerr << "Reading frame " << i << " failed" << std::endl;
+            return 1;
+        }
+        v4l2_luma += cv::mean(gray)[0] / frames;
+    }
+    double v4l2_seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    std::string format = capture.format();
+    int width = gray.cols, height = gray.rows;
+    capture.release();
+
+    // Through OpenCV, converted to BGR and back the way howdy used to do it
+    cv::VideoCapture internal(device, cv::CAP_V4L);
+    cv::Mat frame;
+    double opencv_luma = 0;
+    start = clock_type::now();
+    for (int i = 0; i < frames; i++)
+    {
+        if (!internal.read(frame))
+        {
+            std::cerr << "Reading frame " << i << " through OpenCV failed" << std::endl;
+            return 1;
+        }
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        opencv_luma += cv::mean(gray)[0] / frames;
+    }
+    double opencv_seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+    std::cout << fmt::format("{}: {}x{} {}, {} frames", device, width, height, format, frames) << std::endl;
+    std::cout << fmt::format("v4l2: {:.1f} fps, mean brightness {:.1f}", frames / v4l2_seconds, v4l2_luma) << std::endl;
+    std::cout << fmt::format("OpenCV: {:.1f} fps, mean brightness {:.1f}", frames / opencv_seconds, opencv_luma) << std::endl;
+
+    // The same picture should look the same both ways, up to rounding of the conversions
+    return std::abs(v4l2_luma - opencv_luma) < 2 ? 0 : 1;
+}
@@ -23,17 +23,17 @@
 
 #include "../video_capture.hpp"
 #include "../models.hpp"
+#include "../model_store.hpp"
+#include "../upsample_policy.hpp"
 #include "../snapshot.hpp"
 #include "../rubber_stamps.hpp"
 #include "../utils.hpp"
 
-#include "../utils/json.hpp"
 #include "../utils/argparse.hpp"
 
 #define FMT_HEADER_ONLY
 #include "../fmt/core.h"
 
-using json = nlohmann::json;
 using namespace dlib;
 using namespace std::literals;
 
@@ -57,16 +57,7 @@ void add(argparse::Namespace &args, std::string &user)
     // Read config from disk
     INIReader config(PATH + "/config.ini");
 
-    bool use_cnn = config.GetBoolean("core", "use_cnn", false);
-    face_detection_model *face_detector_p;
-    if (use_cnn)
-    {
-        face_detector_p = new cnn_face_detection_model_v1(PATH + "/dlib-data/mmod_human_face_detector.dat");
-    }
-    else
-    {
-        face_detector_p = new frontal_face_detector_model();
-    }
+    std::unique_ptr<face_detection_model> face_detector_p = make_face_detector(detector_config::read(config));
     face_detection_model &face_detector = *face_detector_p;
 
     shape_predictor_model pose_predictor = shape_predictor_model(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat");
@@ -75,7 +66,7 @@ void add(argparse::Namespace &args, std::string &user)
     // The permanent file to store the encoded model in
     std::string enc_file = PATH + "/models/" + user + ".dat";
     // Known encodings
-    json encodings;
+    std::vector<face_model> encodings;
 
     // Make the ./models folder if it doesn't already exist
     if (!fs::exists(fs::status(PATH + "/models")))
@@ -85,14 +76,9 @@ void add(argparse::Namespace &args, std::string &user)
     }
 
     // To try read a premade encodings file if it exists
-    try
-    {
-        std::ifstream f(enc_file);
-        encodings = json::parse(f);
-    }
-    catch (std::exception &e)
-    {
-    }
+    model_store store;
+    if (store.open(enc_file))
+        encodings = store.models();
 
     // Print a warning if too many encodings are being added
     if (encodings.size() > 3)
@@ -143,11 +129,11 @@ void add(argparse::Namespace &args, std::string &user)
     }
 
     // Prepare the metadata for insertion
-    json insert_model = {
-        {"time", std::chrono::time_point_cast<std::chrono::seconds>(now()).time_since_epoch().count()},
-        {"label", label},
-        {"id", encodings.size()},
-        {"data", {}}};
+    face_model insert_model = {
+        int(encodings.size()),
+        std::chrono::time_point_cast<std::chrono::seconds>(now()).time_since_epoch().count(),
+        label,
+        {}};
 
     // Set up video_capture
     VideoCapture video_capture(config);
@@ -170,6 +156,7 @@ void add(argparse::Namespace &args, std::string &user)
     std::vector<rectangle> face_locations;
 
     double dark_threshold = config.GetReal("video", "dark_threshold", 50.0);
+    upsample_policy upsample(config);
 
     auto clahe = cv::createCLAHE(2.0, cv::Size(8, 8));
 
@@ -180,8 +167,9 @@ void add(argparse::Namespace &args, std::string &user)
     while (frames < 60)
     {
         frames += 1;
-        // Grab a single frame of video
-        video_capture.read_frame(frame, tempframe);
+        // Grab a single frame of video, a replayed recording can run out of them
+        if (!video_capture.read_frame(frame, tempframe))
+            break;
         clahe->apply(tempframe, gsframe);
 
         // Create a histogram of the image with 8 values
@@ -211,7 +199,8 @@ void add(argparse::Namespace &args, std::string &user)
         }
 
         // Get all faces from that frame as encodings
-        face_locations = face_detector(gsframe, 1);
+        face_locations = face_detector(gsframe, upsample.level());
+        upsample.update(face_locations);
 
         // If we've found at least one, we can continue
         if (!face_locations.empty())
@@ -248,15 +237,18 @@ void add(argparse::Namespace &args, std::string &user)
     auto face_landmark = pose_predictor(frame, face_location);
     auto face_encoding = face_encoder.compute_face_descriptor(frame, face_landmark, 1);
 
-    std::vector<double> encoding(face_encoding.begin(), face_encoding.end());
-    insert_model["data"].push_back(encoding);
+    std::vector<float> encoding(face_encoding.begin(), face_encoding.end());
+    insert_model.data.push_back(encoding);
 
     // Insert full object into the list
     encodings.push_back(insert_model);
 
     // Save the new encodings to disk
-    std::ofstream datafile(enc_file);
-    datafile << encodings;
+    if (!model_store::save(enc_file, encodings))
+    {
+        std::cerr << "Failed to save the face model to " << enc_file << std::endl;
+        exit(1);
+    }
 
     // Give let the user know how it went
     std::cout << std::endl
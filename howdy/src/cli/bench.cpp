@@ -0,0 +1,186 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <INIReader.h>
+
+#include "../video_capture.hpp"
+#include "../models.hpp"
+#include "../model_store.hpp"
+#include "../descriptor_matcher.hpp"
+#include "../pipeline.hpp"
+#include "../utils.hpp"
+
+#include "../utils/json.hpp"
+#include "../utils/argparse.hpp"
+
+#define FMT_HEADER_ONLY
+#include "../fmt/core.h"
+
+using json = nlohmann::json;
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    /*Value below which percent of the sorted values lie, by nearest rank*/
+    double percentile(const std::vector<double> &sorted, double percent)
+    {
+        if (sorted.empty())
+            return 0;
+        size_t rank = size_t(std::ceil(percent / 100 * sorted.size()));
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    /*Largest resident set the process had so far, in kilobytes*/
+    long peak_rss_kb()
+    {
+        rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+}
+
+void bench(argparse::Namespace &args, std::string &user)
+{
+    std::vector<std::string> arguments = args.get<std::vector<std::string>>("arguments");
+    if (arguments.empty())
+    {
+        std::cerr << "Please add the recording to run the pipeline over, and optionally the model file to match against" << std::endl;
+        std::cerr << "For example:" << std::endl;
+        std::cerr << std::endl
+                  << "\thowdy bench dark-room.howdyraw" << std::endl
+                  << std::endl;
+        exit(1);
+    }
+
+    std::string recording = arguments[0];
+    std::string model_path = arguments.size() > 1 ? arguments[1] : PATH + "/models/" + user + ".dat";
+    // Machine-friendly output is JSON, to compare builds with
+    bool plain = args.get<bool>("plain");
+
+    if (!fs::exists(recording))
+    {
+        std::cerr << "There is no recording at " << recording << std::endl;
+        exit(1);
+    }
+
+    model_store models;
+    if (!models.open(model_path) || models.descriptor_count() < 1)
+    {
+        std::cerr << "Can't read any face models from " << model_path << std::endl;
+        exit(1);
+    }
+    descriptor_matcher matcher(models.descriptors(), models.descriptor_count());
+
+    INIReader config(PATH + "/config.ini");
+
+    // The models are loaded before the clock starts, only the frames are timed
+    recognition_models recognition;
+    recognition.load(detector_config::read(config), config.GetBoolean("core", "int8_encoder", false));
+    recognition.wait();
+
+    // Paced like the config says, realtime shows how long a login would take, fast the throughput
+    replay_capture::pacing_type pacing = config.Get("video", "replay_pacing", "realtime") == "fast" ? replay_capture::fast : replay_capture::realtime;
+    VideoCapture video_capture(config, recording, pacing);
+
+    pipeline_timings timings;
+    recognition_pipeline pipeline(config, video_capture, recognition, matcher);
+    pipeline.record_timings(&timings);
+
+    // Unlike a login, the whole recording is searched, matches don't end it
+    int matches = 0;
+    double first_match = -1;
+    auto start = std::chrono::steady_clock::now();
+    pipeline.start();
+
+    while (true)
+    {
+        recognition_pipeline::match_result found;
+        recognition_pipeline::result_type result = pipeline.step(100, found);
+        if (result == recognition_pipeline::ended)
+            break;
+
+        if (result == recognition_pipeline::match)
+        {
+            if (matches == 0)
+                first_match = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            matches++;
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    pipeline.stop();
+    video_capture.release();
+
+    std::vector<std::pair<std::string, std::vector<double> *>> stages{
+        {"capture", &timings.capture},
+        {"camera_control", &timings.camera_control},
+        {"preprocess", &timings.preprocess},
+        {"detect", &timings.detect},
+        {"landmark", &timings.landmark},
+        {"encode", &timings.encode},
+        {"match", &timings.match},
+    };
+    for (auto &[name, durations] : stages)
+        std::sort(durations->begin(), durations->end());
+
+    if (plain)
+    {
+        json report = {
+            {"recording", recording},
+            {"model", model_path},
+            {"frames", pipeline.frames()},
+            {"black_frames", pipeline.black_frames()},
+            {"dark_frames", pipeline.dark_frames()},
+            {"seconds", elapsed},
+            {"fps", pipeline.frames() / elapsed},
+            {"matches", matches},
+            {"time_to_first_match_ms", first_match < 0 ? json(nullptr) : json(first_match * 1000)},
+            {"lowest_certainty", pipeline.lowest_certainty() * 10},
+            {"descriptors_reused", pipeline.descriptors().hits()},
+            {"descriptor_lookups", pipeline.descriptors().lookups()},
+            {"encoder", recognition.face_encoder().engine()},
+            {"peak_rss_kb", peak_rss_kb()},
+        };
+
+        for (const auto &[name, durations] : stages)
+        {
+            report["stages"][name] = {
+                {"count", durations->size()},
+                {"p50_ms", percentile(*durations, 50) * 1000},
+                {"p95_ms", percentile(*durations, 95) * 1000},
+                {"p99_ms", percentile(*durations, 99) * 1000},
+            };
+        }
+
+        std::cout << report.dump(4) << std::endl;
+        return;
+    }
+
+    std::cout << fmt::format("Frames: {} in {:.2f}s ({:.1f} fps), {} black and {} dark frames skipped", pipeline.frames(), elapsed, pipeline.frames() / elapsed, pipeline.black_frames(), pipeline.dark_frames()) << std::endl;
+    if (first_match < 0)
+        std::cout << fmt::format("Matches: none, best certainty {:.2f}", pipeline.lowest_certainty() * 10) << std::endl;
+    else
+        std::cout << fmt::format("Matches: {} frames, the first after {:.0f}ms", matches, first_match * 1000) << std::endl;
+    std::cout << "Face encoder: " << recognition.face_encoder().engine() << std::endl;
+    const descriptor_cache &reuse = pipeline.descriptors();
+    if (reuse.enabled())
+        std::cout << fmt::format("Descriptors reused: {} of {} ({:.0f}%)", reuse.hits(), reuse.lookups(), 100.0 * reuse.hits() / std::max(reuse.lookups(), 1)) << std::endl;
+
+    std::cout << std::endl
+              << fmt::format("{:<16}{:>8}{:>10}{:>10}{:>10}", "Stage", "Frames", "p50 ms", "p95 ms", "p99 ms") << std::endl;
+    for (const auto &[name, durations] : stages)
+    {
+        std::cout << fmt::format("{:<16}{:>8}{:>10.2f}{:>10.2f}{:>10.2f}", name, durations->size(), percentile(*durations, 50) * 1000, percentile(*durations, 95) * 1000, percentile(*durations, 99) * 1000) << std::endl;
+    }
+
+    std::cout << std::endl
+              << fmt::format("Peak RSS: {:.1f} MB", peak_rss_kb() / 1024.0) << std::endl;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+
+#include <opencv2/videoio.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <dlib/opencv.h>
+#include <dlib/dnn.h>
+#include <dlib/image_transforms.h>
+
+#include <INIReader.h>
+
+#include "../video_capture.hpp"
+#include "../models.hpp"
+#include "../upsample_policy.hpp"
+#include "../utils.hpp"
+
+#define FMT_HEADER_ONLY
+#include "../fmt/core.h"
+
+using namespace dlib;
+using namespace std::literals;
+
+namespace fs = std::filesystem;
+
+// Faces to calibrate on, and the fewest that still give usable ranges
+const size_t CALIBRATION_CHIPS = 48;
+const size_t MIN_CALIBRATION_CHIPS = 16;
+// Frames to look at before giving up
+const int MAX_FRAMES = 600;
+// Only every few frames is used, so the faces are not all the same
+const int FRAME_SPACING = 5;
+
+void calibrate()
+{
+    // Test if at least 1 of the data files is there and abort if it's not
+    if (!fs::exists(fs::status(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat")))
+    {
+        std::cerr << "Data files have not been downloaded, please run the following commands:" << std::endl;
+        std::cerr << std::endl
+                  << fmt::format("\tcd {}/dlib-data", PATH) << std::endl;
+        std::cerr << "\tsudo ./install.sh" << std::endl
+                  << std::endl;
+        exit(1);
+    }
+
+    // Read config from disk
+    INIReader config(PATH + "/config.ini");
+
+    std::unique_ptr<face_detection_model> face_detector = make_face_detector(detector_config::read(config));
+    shape_predictor_model pose_predictor(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat");
+    face_recognition_model_v1 face_encoder(PATH + "/dlib-data/dlib_face_recognition_resnet_model_v1.dat");
+
+    VideoCapture video_capture(config);
+
+    std::cout << "Calibrating the int8 face encoder" << std::endl;
+    std::cout << "Please look into the camera and slowly turn your head a little" << std::endl;
+
+    // Give the user time to read
+    std::this_thread::sleep_for(2s);
+
+    upsample_policy upsample(config);
+    auto clahe = cv::createCLAHE(2.0, cv::Size(8, 8));
+
+    cv::Mat frame, tempframe, gsframe;
+    std::vector<matrix<rgb_pixel>> chips;
+
+    for (int frames = 0; frames < MAX_FRAMES && chips.size() < CALIBRATION_CHIPS; frames++)
+    {
+        if (!video_capture.read_frame(frame, tempframe))
+            break;
+        if (frames % FRAME_SPACING != 0)
+            continue;
+
+        clahe->apply(tempframe, gsframe);
+        std::vector<rectangle> face_locations = (*face_detector)(gsframe, upsample.level());
+        upsample.update(face_locations);
+
+        // With more than one face we can't tell whose it is
+        if (face_locations.size() != 1)
+            continue;
+
+        // Cut the chip out the same way the encoder does when authenticating
+        full_object_detection face_landmark = pose_predictor(frame, face_locations[0]);
+        chip_details details = get_face_chip_details(face_landmark, int8_encoder::CHIP_SIZE, 0.25);
+        matrix<rgb_pixel> chip;
+        if (frame.channels() == 1)
+            extract_image_chip(cv_image<unsigned char>(frame), details, chip);
+        else
+            extract_image_chip(cv_image<bgr_pixel>(frame), details, chip);
+        chips.push_back(chip);
+
+        std::cout << fmt::format("\rFaces: {}/{}", chips.size(), CALIBRATION_CHIPS) << std::flush;
+    }
+
+    video_capture.release();
+    std::cout << std::endl;
+
+    if (chips.size() < MIN_CALIBRATION_CHIPS)
+    {
+        std::cerr << fmt::format("Only found a face in {} frames, at least {} are needed", chips.size(), MIN_CALIBRATION_CHIPS) << std::endl;
+        exit(1);
+    }
+
+    if (!face_encoder.calibrate_int8(chips))
+    {
+        std::cerr << "Could not calibrate the int8 engine, see the system log" << std::endl;
+        exit(1);
+    }
+
+    std::cout << fmt::format("Calibrated on {} faces, set int8_encoder = true in the config to use it", chips.size()) << std::endl;
+}
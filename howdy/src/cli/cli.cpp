@@ -6,6 +6,10 @@ using namespace std::literals;
 
 void add(argparse::Namespace &args, std::string &user);
 
+void bench(argparse::Namespace &args, std::string &user);
+
+void calibrate();
+
 void clear(argparse::Namespace &args, std::string &user);
 
 void config();
@@ -14,6 +18,8 @@ void disable(argparse::Namespace &args);
 
 void list(argparse::Namespace &args, std::string &user);
 
+void record(argparse::Namespace &args);
+
 void remove(argparse::Namespace &args, std::string &user);
 
 void set(argparse::Namespace &args);
@@ -73,13 +79,13 @@ int main(int argc, char *argv[])
 
     // Add an argument for the command
     parser.add_argument("command")
-        .help("The command option to execute, can be one of the following: add, clear, config, disable, list, remove, snapshot, set, test or version.")
+        .help("The command option to execute, can be one of the following: add, bench, calibrate, clear, config, disable, list, record, remove, snapshot, set, test or version.")
         .metavar("command")
-        .choices({"add", "clear", "config", "disable", "list", "remove", "set", "snapshot", "test", "version"});
+        .choices({"add", "bench", "calibrate", "clear", "config", "disable", "list", "record", "remove", "set", "snapshot", "test", "version"});
 
     // Add an argument for the extra arguments of diable and remove
     parser.add_argument("arguments")
-        .help("Optional arguments for the add, disable, remove and set commands.")
+        .help("Optional arguments for the add, bench, disable, record, remove and set commands.")
         .nargs("*");
 
     // Add the user flag
@@ -139,6 +145,10 @@ int main(int argc, char *argv[])
     std::string command = args.get<std::string>("command");
     if (command == "add")
         add(args, user);
+    else if (command == "bench")
+        bench(args, user);
+    else if (command == "calibrate")
+        calibrate();
     else if (command == "clear")
         clear(args, user);
     else if (command == "config")
@@ -147,6 +157,8 @@ int main(int argc, char *argv[])
         disable(args);
     else if (command == "list")
         list(args, user);
+    else if (command == "record")
+        record(args);
     else if (command == "remove")
         remove(args, user);
     else if (command == "set")
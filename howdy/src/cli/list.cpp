@@ -22,19 +22,18 @@
 
 #include "../video_capture.hpp"
 #include "../models.hpp"
+#include "../model_store.hpp"
 #include "../snapshot.hpp"
 #include "../rubber_stamps.hpp"
 #include "../utils.hpp"
 #include "../utils/string.hpp"
 
-#include "../utils/json.hpp"
 #include "../utils/argparse.hpp"
 
 #define FMT_HEADER_ONLY
 #include "../fmt/core.h"
 #include "../fmt/chrono.h"
 
-using json = nlohmann::json;
 using namespace dlib;
 using namespace std::literals;
 
@@ -58,11 +57,14 @@ void list(argparse::Namespace &args, std::string &user)
     std::string enc_file = PATH + "/models/" + user + ".dat";
 
     // Try to load the models file and abort if the user does not have it yet
-    json encodings;
+    model_store encodings;
     if (fs::exists(fs::status(enc_file)))
     {
-        std::ifstream f(enc_file);
-        encodings = json::parse(f);
+        if (!encodings.open(enc_file))
+        {
+            std::cerr << fmt::format("The face model file of {} could not be read", user) << std::endl;
+            exit(1);
+        }
     }
     else
     {
@@ -83,20 +85,20 @@ void list(argparse::Namespace &args, std::string &user)
     }
 
     // Loop through all encodings and print info about them
-    for (auto &enc : encodings)
+    for (auto &enc : encodings.models())
     {
         // Start with the id
-        std::cout << std::to_string(enc["id"].get<int>());
+        std::cout << std::to_string(enc.id);
 
         // Add comma for machine reading
         if (plain)
             std::cout << ",";
         // Print padding spaces after the id for a nice layout
         else
-            std::cout << std::string(4 - std::to_string(enc["id"].get<int>()).size(), ' ');
+            std::cout << std::string(4 - std::to_string(enc.id).size(), ' ');
 
         // Format the time as ISO in the local timezone
-        time_point time = time_point() + std::chrono::seconds(enc["time"].get<int>());
+        time_point time = time_point() + std::chrono::seconds(enc.time);
         std::cout << fmt::format("{:%Y-%m-%d %H:%M:%S}", time);
         // print(time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(enc["time"])), end="")
 
@@ -104,7 +106,7 @@ void list(argparse::Namespace &args, std::string &user)
         std::cout << (plain ? "," : "  ");
 
         // End with the label
-        std::cout << enc["label"].get<std::string>() << std::endl;
+        std::cout << enc.label << std::endl;
     }
 
     // Add a closing enter
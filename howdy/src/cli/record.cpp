@@ -0,0 +1,226 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/videoio.hpp>
+
+#include <INIReader.h>
+
+#include "../video_capture.hpp"
+#include "../frame_dump.hpp"
+#include "../utils.hpp"
+#include "../utils/blocking_queue.hpp"
+
+#include "../utils/argparse.hpp"
+
+#define FMT_HEADER_ONLY
+#include "../fmt/core.h"
+
+namespace
+{
+    // Frames that can wait for the writer, about three seconds of a fast camera
+    const size_t QUEUE_FRAMES = 90;
+
+    // Length of a recording if none is given
+    const double DEFAULT_SECONDS = 10;
+
+    // Set by ctrl+C, ends the recording early
+    std::atomic<bool> interrupted = false;
+
+    /*A frame on its way to the file*/
+    struct recorded_frame
+    {
+        cv::Mat pixels;
+        double seconds = 0;
+        // Set on an empty item after the last frame
+        bool end = false;
+    };
+
+    /*Frames missing from gaps in the timestamps, counted against the usual frame interval*/
+    int timestamp_gaps(const std::vector<double> &stamps)
+    {
+        std::vector<double> intervals;
+        for (size_t i = 1; i < stamps.size(); i++)
+            intervals.push_back(stamps[i] - stamps[i - 1]);
+        if (intervals.empty())
+            return 0;
+
+        std::vector<double> sorted = intervals;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        double usual = sorted[sorted.size() / 2];
+        if (usual <= 0)
+            return 0;
+
+        // A frame and a half of silence means at least one went missing
+        int missing = 0;
+        for (double interval : intervals)
+        {
+            if (interval > usual * 1.5)
+                missing += int(std::lround(interval / usual)) - 1;
+        }
+        return missing;
+    }
+}
+
+void record(argparse::Namespace &args)
+{
+    std::vector<std::string> arguments = args.get<std::vector<std::string>>("arguments");
+    if (arguments.empty())
+    {
+        std::cerr << "Please add the file to record to, and optionally the number of seconds to record" << std::endl;
+        std::cerr << "For example:" << std::endl;
+        std::cerr << std::endl
+                  << "\thowdy record dark-room.howdyraw 20" << std::endl
+                  << std::endl;
+        exit(1);
+    }
+
+    std::string path = arguments[0];
+    double duration = DEFAULT_SECONDS;
+    if (arguments.size() > 1)
+    {
+        try
+        {
+            duration = std::stod(arguments[1]);
+        }
+        catch (const std::exception &)
+        {
+            duration = 0;
+        }
+
+        if (duration <= 0)
+        {
+            std::cerr << "The number of seconds to record has to be a positive number" << std::endl;
+            exit(1);
+        }
+    }
+
+    INIReader config(PATH + "/config.ini");
+    VideoCapture video_capture(config);
+    int exposure = config.GetInteger("video", "exposure", -1);
+
+    // The first frame tells what all the others look like
+    cv::Mat raw;
+    if (!video_capture.read_raw(raw))
+    {
+        std::cerr << "The recording set as device_path has no frames" << std::endl;
+        exit(1);
+    }
+
+    frame_dump_header header = {};
+    header.width = raw.cols;
+    header.height = raw.rows;
+    header.type = raw.type();
+    header.compression = frame_dump_writer::has_lz4() ? FRAME_DUMP_LZ4 : FRAME_DUMP_UNCOMPRESSED;
+    header.fourcc = uint32_t(video_capture.get(cv::CAP_PROP_FOURCC));
+    header.requested_width = video_capture.fw;
+    header.requested_height = video_capture.fh;
+    header.exposure = video_capture.get(cv::CAP_PROP_EXPOSURE);
+
+    frame_dump_writer writer;
+    if (!writer.open(path, header))
+    {
+        std::cerr << "Can't write to " << path << std::endl;
+        exit(1);
+    }
+
+    // Packing and writing happens on its own thread, so a slow disk never
+    // holds up the camera. Frames it can't keep up with are dropped and counted
+    BlockingQueue<recorded_frame> pending(QUEUE_FRAMES);
+    std::atomic<int> write_errors = 0;
+    std::thread writer_thread([&]()
+    {
+        recorded_frame item;
+        while (pending.waitAndPop(item) && !item.end)
+        {
+            if (!writer.write(item.pixels, item.seconds))
+                write_errors++;
+        }
+    });
+
+    std::signal(SIGINT, [](int) { interrupted = true; });
+
+    std::cout << fmt::format("Recording {}x{} frames to {} for {:.0f} seconds, press ctrl+C to stop early", header.width, header.height, path, duration) << std::endl;
+
+    int recorded = 0;
+    int dropped = 0;
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0;
+
+    // When the camera took every frame, to find the ones the driver dropped
+    // without telling. OpenCV passes on the timestamp of the driver, if not
+    // the time of the read stands in for it
+    std::vector<double> camera_stamps;
+    std::vector<double> read_stamps;
+    camera_stamps.reserve(size_t(duration * 60));
+    read_stamps.reserve(size_t(duration * 60));
+
+    while (!interrupted)
+    {
+        // Frames of the v4l2 plugin are only valid until the next read, the queue gets a copy
+        if (!pending.tryPush(recorded_frame{raw.clone(), seconds}))
+            dropped++;
+        recorded++;
+        camera_stamps.push_back(video_capture.get(cv::CAP_PROP_POS_MSEC) / 1000);
+        read_stamps.push_back(seconds);
+
+        if (exposure != -1)
+        {
+            // Set every frame like howdy-auth does, some cameras ignore it otherwise
+            video_capture.set(cv::CAP_PROP_AUTO_EXPOSURE, 1.0);
+            video_capture.set(cv::CAP_PROP_EXPOSURE, double(exposure));
+        }
+
+        if (!video_capture.read_raw(raw))
+            break;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds > duration)
+            break;
+    }
+
+    // Wait for everything before the end to be written
+    recorded_frame end;
+    end.end = true;
+    pending.push(end);
+    writer_thread.join();
+    video_capture.release();
+    std::signal(SIGINT, SIG_DFL);
+
+    if (!writer.close())
+        write_errors++;
+
+    // Sequence numbers of the v4l2 plugin are exact, timestamps only show longer gaps
+    long driver_dropped = video_capture.driver_drops();
+    std::string drop_source = "sequence numbers";
+    if (driver_dropped < 0)
+    {
+        bool camera_timed = !camera_stamps.empty() && camera_stamps.front() > 0 &&
+                            std::adjacent_find(camera_stamps.begin(), camera_stamps.end(), std::greater_equal<double>()) == camera_stamps.end();
+        driver_dropped = timestamp_gaps(camera_timed ? camera_stamps : read_stamps);
+        drop_source = camera_timed ? "camera timestamps" : "read times";
+    }
+
+    double elapsed = std::max(seconds, 1e-6);
+    std::cout << fmt::format("Captured {} frames in {:.1f} seconds ({:.1f} fps)", recorded, seconds, recorded / elapsed) << std::endl;
+    std::cout << fmt::format("Dropped by the camera: {} (from {})", driver_dropped, drop_source) << std::endl;
+    std::cout << fmt::format("Dropped by the writer: {}", dropped) << std::endl;
+    std::cout << fmt::format("File size: {:.1f} MB{}", writer.size() / 1e6, header.compression == FRAME_DUMP_LZ4 ? " (LZ4 compressed)" : "") << std::endl;
+
+    if (write_errors > 0)
+    {
+        std::cerr << fmt::format("{} frames could not be written, the recording is incomplete", int(write_errors)) << std::endl;
+        exit(1);
+    }
+
+    std::cout << std::endl
+              << "Set device_path to this file to replay it" << std::endl;
+}
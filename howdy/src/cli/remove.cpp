@@ -22,19 +22,18 @@
 
 #include "../video_capture.hpp"
 #include "../models.hpp"
+#include "../model_store.hpp"
 #include "../snapshot.hpp"
 #include "../rubber_stamps.hpp"
 #include "../utils.hpp"
 #include "../utils/string.hpp"
 
-#include "../utils/json.hpp"
 #include "../utils/argparse.hpp"
 
 #define FMT_HEADER_ONLY
 #include "../fmt/core.h"
 #include "../fmt/chrono.h"
 
-using json = nlohmann::json;
 using namespace dlib;
 using namespace std::literals;
 
@@ -74,11 +73,16 @@ void remove(argparse::Namespace &args, std::string &user)
     std::string enc_file = PATH + "/models/" + user + ".dat";
 
     // Try to load the models file and abort if the user does not have it yet
-    json encodings;
+    std::vector<face_model> encodings;
     if (fs::exists(fs::status(enc_file)))
     {
-        std::ifstream f(enc_file);
-        encodings = json::parse(f);
+        model_store store;
+        if (!store.open(enc_file))
+        {
+            std::cerr << fmt::format("The face model file of {} could not be read", user) << std::endl;
+            exit(1);
+        }
+        encodings = store.models();
     }
     else
     {
@@ -98,14 +102,14 @@ void remove(argparse::Namespace &args, std::string &user)
     // Loop though all encodings and check if they match the argument
     for (auto &enc : encodings)
     {
-        if (std::to_string(enc["id"].get<int>()) == id)
+        if (std::to_string(enc.id) == id)
         {
             // Only ask the user if there's no -y flag
             if (!args.get<bool>("y"))
             {
                 // Double check with the user
                 std::cout << fmt::format(
-                                 "This will remove the model called \"{}\" for {}", enc["label"].get<std::string>(), user)
+                                 "This will remove the model called \"{}\" for {}", enc.label, user)
                           << std::endl;
                 std::cout << "Do you want to continue [y/N]: ";
                 std::string ans;
@@ -145,18 +149,21 @@ void remove(argparse::Namespace &args, std::string &user)
     else
     {
         // A place holder to contain the encodings that will remain
-        json new_encodings;
+        std::vector<face_model> new_encodings;
 
         // Loop though all encodings and only add those that don't need to be removed
         for (auto enc : encodings)
         {
-            if (std::to_string(enc["id"].get<int>()) != id)
+            if (std::to_string(enc.id) != id)
                 new_encodings.push_back(enc);
         }
 
         // Save this new set to disk
-        std::ofstream datafile(enc_file);
-        datafile << new_encodings;
+        if (!model_store::save(enc_file, new_encodings))
+        {
+            std::cerr << "Failed to save the face models to " << enc_file << std::endl;
+            exit(1);
+        }
 
         std::cout << fmt::format("Removed model {}", id) << std::endl;
     }
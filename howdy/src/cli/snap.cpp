@@ -52,7 +52,11 @@ void snapshot()
 
 	// Read a frame to activate emitters
 	cv::Mat frame, gsframe;
-	video_capture.read_frame(frame, gsframe);
+	if (!video_capture.read_frame(frame, gsframe))
+	{
+		std::cerr << "The recording has no frames to make a snapshot of" << std::endl;
+		return;
+	}
 
 	// Read exposure and dark_thresholds from config to use in the main loop
 	int exposure = config.GetInteger("video", "exposure", -1);
@@ -63,8 +67,9 @@ void snapshot()
 
 	while (true)
 	{
-		// Grab a single frame of video
-		video_capture.read_frame(frame, gsframe);
+		// Grab a single frame of video, a replayed recording may not have 4 left
+		if (!video_capture.read_frame(frame, gsframe))
+			break;
 
 		// Add the frame to the list
 		frames.push_back(frame);
@@ -23,6 +23,7 @@
 
 #include "../video_capture.hpp"
 #include "../models.hpp"
+#include "../upsample_policy.hpp"
 #include "../snapshot.hpp"
 #include "../rubber_stamps.hpp"
 #include "../utils.hpp"
@@ -70,6 +71,7 @@ void test()
     // Read exposure and dark_thresholds from config to use in the main loop
     int exposure = config.GetInteger("video", "exposure", -1);
     double dark_threshold = config.GetReal("video", "dark_threshold", 50.0);
+    upsample_policy upsample(config);
 
     // Let the user know what's up
     std::cout << R"(
@@ -79,17 +81,7 @@ Press ctrl+C in this terminal to quit
 Click on the image to enable or disable slow mode
 )" << std::endl;
 
-    bool use_cnn = config.GetBoolean("core", "use_cnn", false);
-
-    face_detection_model *face_detector_p;
-    if (use_cnn)
-    {
-        face_detector_p = new cnn_face_detection_model_v1(PATH + "/dlib-data/mmod_human_face_detector.dat");
-    }
-    else
-    {
-        face_detector_p = new frontal_face_detector_model();
-    }
+    std::unique_ptr<face_detection_model> face_detector_p = make_face_detector(detector_config::read(config));
     face_detection_model &face_detector = *face_detector_p;
 
     auto clahe = cv::createCLAHE(2.0, cv::Size(8, 8));
@@ -134,7 +126,9 @@ Click on the image to enable or disable slow mode
             // Grab a single frame of video
             cv::Mat tempframe;
             cv::Mat ret, frame;
-            video_capture.read_frame(ret, tempframe);
+            // Stop when a replayed recording has no frames left
+            if (!video_capture.read_frame(ret, tempframe))
+                break;
 
             clahe->apply(tempframe, frame);
             // Make a frame to put overlays in
@@ -179,6 +173,7 @@ Click on the image to enable or disable slow mode
             print_text(1, fmt::format("FPS: {}", fps));
             print_text(2, fmt::format("FRAMES: {}", total_frames));
             print_text(3, fmt::format("RECOGNITION: {}ms", std::round(rec_tm * 1000)));
+            print_text(4, fmt::format("UPSAMPLE: {}", upsample.level()));
 
             // Show that slow mode is on, if it's on
             if (slow_mode)
@@ -197,8 +192,8 @@ Click on the image to enable or disable slow mode
 
                 rec_tm = std::chrono::time_point_cast<std::chrono::seconds>(now()).time_since_epoch().count();
                 // Get the locations of all faces and their locations
-                // Upsample it once
-                std::vector<rectangle> face_locations = face_detector(frame, 1);
+                std::vector<rectangle> face_locations = face_detector(frame, upsample.level());
+                upsample.update(face_locations);
                 rec_tm = std::chrono::time_point_cast<std::chrono::seconds>(now()).time_since_epoch().count() - rec_tm;
 
                 // Loop though all faces and paint a circle around them
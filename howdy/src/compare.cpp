@@ -3,13 +3,15 @@
 #include <unistd.h>
 #include <limits.h>
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
 #include <chrono>
-#include <map>
 #include <iomanip>
 #include <ctime>
+#include <thread>
+#include <atomic>
 
 #include <opencv2/videoio.hpp>
 #include <opencv2/imgproc.hpp>
@@ -21,26 +23,33 @@
 
 #include <INIReader.h>
 
+#include "compare.hpp"
 #include "video_capture.hpp"
 #include "models.hpp"
+#include "model_store.hpp"
+#include "descriptor_matcher.hpp"
+#include "pipeline.hpp"
+#include "image_context.hpp"
 #include "snapshot.hpp"
+#include "trace.hpp"
 #include "rubber_stamps.hpp"
 #include "utils.hpp"
 
-#include "utils/json.hpp"
 #include "process/process.hpp"
 
 #define FMT_HEADER_ONLY
 #include "fmt/core.h"
 #include "fmt/chrono.h"
 
-using json = nlohmann::json;
 using namespace dlib;
 using namespace TinyProcessLib;
 
 namespace fs = std::filesystem;
 
-typedef std::chrono::time_point<std::chrono::system_clock> time_point;
+typedef std::chrono::steady_clock attempt_clock;
+
+// Trace files kept in the traces folder, older ones are removed
+const size_t MAX_TRACES = 20;
 
 std::shared_ptr<Process> gtk_proc;
 std::function<void(const char *bytes, size_t n)> gtk_pipe;
@@ -59,6 +68,8 @@ void send_to_ui(std::string type, std::string message)
     // Only execute of the proccess started
     if (gtk_proc)
     {
+        trace::span span("ui send");
+
         // Format message so the ui can parse it
         message = type + "=" + message + " \n";
 
@@ -67,39 +78,22 @@ void send_to_ui(std::string type, std::string message)
     }
 }
 
-int main(int argc, char *argv[])
+void compare(const std::string &username, recognition_models &recognition)
 {
     cv::utils::logging::setLogLevel(cv::utils::logging::LOG_LEVEL_SILENT);
 
-    std::map<std::string, time_point> start_times;
-    std::map<std::string, std::chrono::duration<double>> timings;
-
-    start_times["st"] = now();
+    // When the attempt and the search for a face started
+    attempt_clock::time_point attempt_start = attempt_clock::now();
+    attempt_clock::time_point search_start;
+    // Durations for the end report
+    std::chrono::duration<double> startup_time, camera_time;
 
     openlog("howdy-auth", 0, LOG_AUTHPRIV);
 
-    // Make sure we were given an username to test against
-    if (argc < 2)
-    {
-        exit(12);
-    }
-
     // The username of the user being authenticated
-    char *user = argv[1];
-    // The model file contents
-    json models;
-    // Encoded face models
-    std::vector<matrix<double, 0, 1>> encodings;
-    // Amount of ignored 100% black frames
-    int black_tries = 0;
-    // Amount of ingnored dark frames
-    int dark_tries = 0;
-    // Total amount of frames captured
-    int frames = 0;
-    // Captured frames for snapshot capture
-    std::vector<cv::Mat> snapframes;
-    // Tracks the lowest certainty value in the loop
-    double lowest_certainty = 10;
+    const char *user = username.c_str();
+    // The model file, its descriptors are used to match faces as they are stored
+    model_store models;
 
     // Try to load the face model from the models folder
     if (!fs::exists(fs::status(PATH + "/models/" + user + ".dat")))
@@ -107,22 +101,21 @@ int main(int argc, char *argv[])
         syslog(LOG_ERR, "Model file not found for user %s", user);
         exit(10);
     }
-    std::ifstream f(PATH + "/models/" + user + ".dat");
-    models = json::parse(f);
-    for (auto &model : models)
+    if (!models.open(PATH + "/models/" + user + ".dat"))
     {
-        for (auto &row : model["data"])
-        {
-            encodings.push_back(mat(std::vector<double>(row)));
-        }
+        syslog(LOG_ERR, "Failed to read the model file of user %s", user);
+        exit(10);
     }
 
     // Check if the file contains a model
-    if (models.size() < 1)
+    if (models.descriptor_count() < 1)
     {
         exit(10);
     }
 
+    // Matches straight from the mapped file
+    descriptor_matcher matcher(models.descriptors(), models.descriptor_count());
+
     // Read config from disk
     INIReader config(PATH + "/config.ini");
 
@@ -134,15 +127,18 @@ int main(int argc, char *argv[])
     }
 
     // Get all config values needed
-    bool use_cnn = config.GetBoolean("core", "use_cnn", false);
+    detector_config detector_settings = detector_config::read(config);
+    bool use_int8 = config.GetBoolean("core", "int8_encoder", false);
     int timeout = config.GetInteger("video", "timeout", 5);
     double dark_threshold = config.GetReal("video", "dark_threshold", 50.0);
-    double video_certainty = config.GetReal("video", "certainty", 3.5) / 10;
     bool end_report = config.GetBoolean("debug", "end_report", false);
     bool capture_failed = config.GetBoolean("snapshots", "capture_failed", false);
     bool capture_successful = config.GetBoolean("snapshots", "capture_successful", false);
     bool gtk_stdout = config.GetBoolean("debug", "gtk_stdout", false);
-    int rotate = config.GetInteger("video", "rotate", 0);
+
+    // Spans of every thread are recorded from here on if enabled, this thread encodes and matches
+    trace::enable(config.GetBoolean("debug", "trace", false));
+    trace::name_thread("match");
 
     // Send the gtk outupt to the terminal if enabled in the config
     if (gtk_stdout)
@@ -159,314 +155,230 @@ int main(int argc, char *argv[])
     send_to_ui("M", "Starting up...");
 
     // Save the time needed to start the script
-    timings["in"] = now() - start_times["st"];
+    startup_time = attempt_clock::now() - attempt_start;
 
     // Import face recognition, takes some time
-    start_times["ll"] = now();
-
     if (!fs::is_regular_file(fs::status(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat")))
     {
         syslog(LOG_ERR, "Data files have not been downloaded");
         exit(1);
     }
 
-    face_detection_model *face_detector_p;
-    if (use_cnn)
-    {
-        face_detector_p = new cnn_face_detection_model_v1(PATH + "/dlib-data/mmod_human_face_detector.dat");
-    }
-    else
-    {
-        face_detector_p = new frontal_face_detector_model();
-    }
-    face_detection_model &face_detector = *face_detector_p;
-
-    // Start the others regardless
-    shape_predictor_model pose_predictor = shape_predictor_model(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat");
-    face_recognition_model_v1 face_encoder = face_recognition_model_v1(PATH + "/dlib-data/dlib_face_recognition_resnet_model_v1.dat");
-
-    // Note the time it took to initialize detectors
-    timings["ll"] = now() - start_times["ll"];
+    // Loads in the background while the camera opens, and is skipped
+    // entirely if howdy-authd already has the models in memory
+    recognition.load(detector_settings, use_int8);
 
     // Start video capture on the IR camera
-    start_times["ic"] = now();
+    attempt_clock::time_point camera_start = attempt_clock::now();
+    int64_t camera_start_ns = trace::now_ns();
 
     VideoCapture video_capture(config);
 
-    // Read exposure from config to use in the main loop
-    int exposure = config.GetInteger("video", "exposure", -1);
-
     // Note the time it took to open the camera
-    timings["ic"] = now() - start_times["ic"];
-
-    // Fetch the max frame height
-    double max_height = config.GetReal("video", "max_height", 0.0);
+    camera_time = attempt_clock::now() - camera_start;
+    if (trace::enabled())
+        trace::record("open camera", camera_start_ns, trace::now_ns());
 
-    // Get the height of the image (which would be the width if screen is portrait oriented)
-    double height;
-    height = video_capture.get(cv::CAP_PROP_FRAME_HEIGHT);
-    if (rotate == 2)
-    {
-        height = video_capture.get(cv::CAP_PROP_FRAME_WIDTH);
-    }
-    if (height == 0)
-    {
-        height = 1;
-    }
-    // Calculate the amount the image has to shrink
-    double scaling_factor = max_height / height;
-    if (scaling_factor == 0)
-    {
-        scaling_factor = 1;
-    }
+    // Capture, detection and matching, each stage on its own thread
+    recognition_pipeline pipeline(config, video_capture, recognition, matcher);
 
-    // Initiate histogram equalization
-    auto clahe = cv::createCLAHE(2.0, cv::Size(8, 8));
+    // Only the frames for a snapshot are needed in color
+    if (capture_failed || capture_successful)
+        pipeline.keep_color_frames(3);
 
     // Let the ui know that we're ready
     send_to_ui("M", "Identifying you...");
 
     // Start the read loop
-    frames = 0;
-    int valid_frames = 0;
-    start_times["fr"] = now();
-    double dark_running_total = 0;
+    search_start = attempt_clock::now();
+    pipeline.start();
 
     /* Generate snapshot after detection */
     auto make_snapshot = [&](std::string type)
     {
+        trace::span span("snapshot");
+        std::chrono::duration<double> scan_time = attempt_clock::now() - search_start;
+
         char hostname[HOST_NAME_MAX];
         gethostname(hostname, HOST_NAME_MAX);
 
+        int frames = pipeline.frames();
         std::vector<std::string> text_lines{
             type + " LOGIN",
             "Date: " + fmt::format("{:%Y/%m/%d %H:%M:%S} UTC", now()),
-            "Scan time: " + fmt::format("{:.2f}", std::chrono::duration_cast<std::chrono::milliseconds>(now() - start_times["fr"]).count() / 1000.0) + "s",
-            "Frames: " + std::to_string(frames) + " (" + fmt::format("{:.2f}", double(frames) / std::chrono::duration_cast<std::chrono::seconds>(now() - start_times["fr"]).count()) + "FPS)",
+            "Scan time: " + fmt::format("{:.2f}", std::chrono::duration_cast<std::chrono::milliseconds>(scan_time).count() / 1000.0) + "s",
+            "Frames: " + std::to_string(frames) + " (" + fmt::format("{:.2f}", double(frames) / std::chrono::duration_cast<std::chrono::seconds>(scan_time).count()) + "FPS)",
             "Hostname: " + std::string(hostname),
-            "Best certainty value: " + fmt::format("{:.1f}", lowest_certainty * 10)};
+            "Best certainty value: " + fmt::format("{:.1f}", pipeline.lowest_certainty() * 10)};
+        std::vector<cv::Mat> snapframes = pipeline.color_frames();
         generate(snapframes, text_lines);
     };
 
-    while (true)
+    /* Writes the spans of the attempt to the traces folder, if tracing is enabled */
+    auto save_trace = [&]()
     {
-        // Increment the frame count every loop
-        frames += 1;
+        if (!trace::enabled())
+            return;
 
-        // Form a string to let the user know we're real busy
-        std::string ui_subtext = "Scanned " + std::to_string(valid_frames - dark_tries) + " frames";
-        if (dark_tries > 1)
+        // Made sure a trace folder exist
+        if (!fs::exists(fs::status(PATH + "/traces")))
         {
-            ui_subtext += " (skipped " + std::to_string(dark_tries) + " dark frames)";
+            fs::create_directories(PATH + "/traces");
         }
-        // Show it in the ui as subtext
-        send_to_ui("S", ui_subtext);
 
-        // Stop if we've exceded the time limit
-        if (std::chrono::duration<double>(now() - start_times["fr"]).count() > timeout)
-        {
-            // Create a timeout snapshot if enabled
-            if (capture_failed)
-            {
-                make_snapshot("FAILED");
-            }
+        std::string file = PATH + "/traces/" + fmt::format("{:%Y%m%dT%H%M%S}", now()) + ".json";
+        if (trace::dump(file))
+            syslog(LOG_INFO, "Trace of the attempt saved as %s", file.c_str());
+        else
+            syslog(LOG_ERR, "Failed to save the trace of the attempt to %s", file.c_str());
 
-            if (dark_tries == valid_frames)
-            {
-                syslog(LOG_ERR, "All frames were too dark, please check dark_threshold in config");
-                syslog(LOG_ERR, "Average darkness: %f, Threshold: %f", dark_running_total / std::max(1, valid_frames), dark_threshold);
-                exit(13);
-            }
-            else
-            {
-                exit(11);
-            }
+        // Only keep the latest traces, the names sort by the time they were taken
+        std::vector<fs::path> traces;
+        std::error_code error;
+        for (const auto &entry : fs::directory_iterator(PATH + "/traces", error))
+        {
+            if (entry.path().extension() == ".json")
+                traces.push_back(entry.path());
         }
+        std::sort(traces.begin(), traces.end());
+        for (size_t i = 0; i + MAX_TRACES < traces.size(); i++)
+            fs::remove(traces[i], error);
+    };
 
-        // Grab a single frame of video
-        cv::Mat tempframe;
-        cv::Mat frame, gsframe;
-        video_capture.read_frame(frame, tempframe);
-        clahe->apply(tempframe, gsframe);
+    /* Ends the search without a match, when the time is up or there are no frames left */
+    auto give_up = [&]()
+    {
+        pipeline.stop();
 
-        // If snapshots have been turned on
-        if (capture_failed || capture_successful)
+        // Create a timeout snapshot if enabled
+        if (capture_failed)
         {
-            // Start capturing frames for the snapshot
-            if (snapframes.size() < 3)
-                snapframes.push_back(frame);
+            make_snapshot("FAILED");
         }
 
-        // Create a histogram of the image with 8 values
-        cv::Mat hist;
-        cv::calcHist(std::vector<cv::Mat>{gsframe}, std::vector<int>{0}, cv::Mat(), hist, std::vector<int>{8}, std::vector<float>{0, 256});
-        // All values combined for percentage calculation
-        double hist_total = cv::sum(hist)[0];
+        save_trace();
 
-        // Calculate frame darkness
-        double darkness = (hist.at<float>(0) / hist_total * 100);
-
-        // If the image is fully black due to a bad camera read,
-        // skip to the next frame
-        if ((hist_total == 0) or (darkness == 100))
+        if (pipeline.dark_frames() == pipeline.valid_frames())
         {
-            black_tries += 1;
-            continue;
+            syslog(LOG_ERR, "All frames were too dark, please check dark_threshold in config");
+            syslog(LOG_ERR, "Average darkness: %f, Threshold: %f", pipeline.average_darkness(), dark_threshold);
+            exit(13);
         }
-
-        dark_running_total += darkness;
-        valid_frames += 1;
-        // If the image exceeds darkness threshold due to subject distance,
-        // skip to the next frame
-        if (darkness > dark_threshold)
+        else
         {
-            dark_tries += 1;
-            continue;
+            exit(11);
         }
+    };
 
-        // If the height is too high
-        if (scaling_factor != 1)
-        {
-            // Apply that factor to the frame
-            cv::resize(frame, tempframe, cv::Size(), scaling_factor, scaling_factor, cv::INTER_AREA);
-            frame = tempframe;
-            cv::resize(gsframe, tempframe, cv::Size(), scaling_factor, scaling_factor, cv::INTER_AREA);
-            gsframe = tempframe;
-        }
-        // If camera is configured to rotate = 1, check portrait in addition to landscape
-        if (rotate == 1)
+    // The encoding and matching stage runs here
+    while (true)
+    {
+        // Form a string to let the user know we're real busy
+        int dark_tries = pipeline.dark_frames();
+        std::string ui_subtext = "Scanned " + std::to_string(pipeline.valid_frames() - dark_tries) + " frames";
+        if (dark_tries > 1)
         {
-            if (frames % 3 == 1)
-            {
-                cv::rotate(frame, tempframe, cv::ROTATE_90_COUNTERCLOCKWISE);
-                frame = tempframe;
-                cv::rotate(gsframe, tempframe, cv::ROTATE_90_COUNTERCLOCKWISE);
-                gsframe = tempframe;
-            }
-            if (frames % 3 == 2)
-            {
-                cv::rotate(frame, tempframe, cv::ROTATE_90_CLOCKWISE);
-                frame = tempframe;
-                cv::rotate(gsframe, tempframe, cv::ROTATE_90_CLOCKWISE);
-                gsframe = tempframe;
-            }
+            ui_subtext += " (skipped " + std::to_string(dark_tries) + " dark frames)";
         }
-        // If camera is configured to rotate = 2, check portrait orientation
-        else if (rotate == 2)
+        // Show it in the ui as subtext
+        send_to_ui("S", ui_subtext);
+
+        // Stop if we've exceded the time limit
+        if (std::chrono::duration<double>(attempt_clock::now() - search_start).count() > timeout)
+            give_up();
+
+        // Wake up regularly to keep the ui and the timeout up to date
+        recognition_pipeline::match_result found;
+        recognition_pipeline::result_type result = pipeline.step(100, found);
+
+        // A replayed recording ran out of frames without a match
+        if (result == recognition_pipeline::ended)
         {
-            if (frames % 2 == 0)
-            {
-                cv::rotate(frame, tempframe, cv::ROTATE_90_COUNTERCLOCKWISE);
-                frame = tempframe;
-                cv::rotate(gsframe, tempframe, cv::ROTATE_90_COUNTERCLOCKWISE);
-                gsframe = tempframe;
-            }
-            else
-            {
-                cv::rotate(frame, tempframe, cv::ROTATE_90_CLOCKWISE);
-                frame = tempframe;
-                cv::rotate(gsframe, tempframe, cv::ROTATE_90_CLOCKWISE);
-                gsframe = tempframe;
-            }
+            syslog(LOG_INFO, "Reached the end of the recording");
+            give_up();
         }
 
-        // Get all faces from that frame as encodings
-        // Upsamples 1 time
-        std::vector<rectangle> face_locations = face_detector(gsframe, 1);
+        if (result != recognition_pipeline::match)
+            continue;
 
-        // Loop through each face
-        for (auto &&fl : face_locations)
-        {
-            // Fetch the faces in the image
-            auto face_landmark = pose_predictor(frame, fl);
-            auto face_encoding = face_encoder.compute_face_descriptor(frame, face_landmark, 1);
+        size_t match_index = found.best.index;
+        double match = found.best.distance;
 
-            // Match this found face against a known face
-            std::vector<double> matches;
-            std::transform(encodings.begin(), encodings.end(), std::back_inserter(matches), [face_encoding](auto &encoding)
-                           { return sqrt(sum(squared(encoding - face_encoding))); });
+        std::chrono::duration<double> total_time = attempt_clock::now() - attempt_start;
+        std::chrono::duration<double> search_time = attempt_clock::now() - search_start;
+        // Note the time it took to initialize detectors
+        std::chrono::duration<double> load_time = recognition.load_time();
 
-            // Get best match
-            int match_index = static_cast<int>(std::distance(matches.begin(), min_element(matches.begin(), matches.end())));
-            double match = matches[match_index];
+        // The camera and the detector are needed by the rubberstamps
+        pipeline.stop();
 
-            // Update certainty if we have a new low
-            if (lowest_certainty > match)
+        // If set to true in the config, print debug text
+        if (end_report)
+        {
+            /*
+            Helper function to print a timing from the list
+            */
+            auto syslog_timing = [](std::string label, std::chrono::duration<double> time)
             {
-                lowest_certainty = match;
-            }
-
-            // Check if a match that's confident enough
-            if (0 < match && match < video_certainty)
+                syslog(LOG_INFO, "  %s: %dms", label.c_str(), int(round(time.count() * 1000)));
+            };
+
+            // Print a nice timing report
+            syslog(LOG_INFO, "Time spent");
+            syslog_timing("Starting up", startup_time);
+            syslog(LOG_INFO, "  Open cam + load libs: %dms", int(round(std::max(load_time.count(), camera_time.count()) * 1000)));
+            syslog_timing("  Opening the camera", camera_time);
+            syslog_timing("  Importing recognition libs", load_time);
+            syslog_timing("Searching for known face", search_time);
+            syslog_timing("Total time", total_time);
+
+            syslog(LOG_INFO, "\nResolution");
+            double width = video_capture.fw;
+            if (width == 0)
             {
-                timings["tt"] = now() - start_times["st"];
-                timings["fl"] = now() - start_times["fr"];
-
-                // If set to true in the config, print debug text
-                if (end_report)
-                {
-                    /*
-                    Helper function to print a timing from the list
-                    */
-                    auto syslog_timing = [&timings](std::string label, std::string k)
-                    {
-                        syslog(LOG_INFO, "  %s: %dms", label.c_str(), int(round(timings[k].count() * 1000)));
-                    };
-
-                    // Print a nice timing report
-                    syslog(LOG_INFO, "Time spent");
-                    syslog_timing("Starting up", "in");
-                    syslog(LOG_INFO, "  Open cam + load libs: %dms", int(round(std::max(timings["ll"].count(), timings["ic"].count()) * 1000)));
-                    syslog_timing("  Opening the camera", "ic");
-                    syslog_timing("  Importing recognition libs", "ll");
-                    syslog_timing("Searching for known face", "fl");
-                    syslog_timing("Total time", "tt");
-
-                    syslog(LOG_INFO, "\nResolution");
-                    double width = video_capture.fw;
-                    if (width == 0)
-                    {
-                        width = 1;
-                    }
-                    syslog(LOG_INFO, "  Native: %dx%d", int(height), int(width));
-                    // Save the new size for diagnostics
-                    int scale_height = frame.rows;
-                    int scale_width = frame.cols;
-                    syslog(LOG_INFO, "  Used: %dx%d", scale_height, scale_width);
-
-                    // Show the total number of frames and calculate the FPS by deviding it by the total scan time
-                    syslog(LOG_INFO, "\nFrames searched: %d (%.2f fps)", frames, frames / timings["fl"].count());
-                    syslog(LOG_INFO, "Black frames ignored: %d ", black_tries);
-                    syslog(LOG_INFO, "Dark frames ignored: %d ", dark_tries);
-                    syslog(LOG_INFO, "Certainty of winning frame: %.3f", match * 10);
-
-                    syslog(LOG_INFO, "Winning model: %d (\"%s\")", match_index, std::string(models[match_index]["label"]).c_str());
-                }
-                // Make snapshot if enabled
-                if (capture_successful)
-                {
-                    make_snapshot("SUCCESSFUL");
-                }
-
-                // Run rubberstamps if enabled
-                if (config.GetBoolean("rubberstamps", "enabled", false))
-                {
-                    OpenCV opencv(video_capture, face_detector, pose_predictor, clahe);
-                    execute(config, gtk_proc, opencv);
-
-                    send_to_ui("S", "");
-                }
-
-                // End peacefully
-                exit(0);
+                width = 1;
             }
+            syslog(LOG_INFO, "  Native: %dx%d", int(pipeline.native_height()), int(width));
+            // Save the new size for diagnostics
+            int scale_height = found.frame.rows;
+            int scale_width = found.frame.cols;
+            syslog(LOG_INFO, "  Used: %dx%d", scale_height, scale_width);
+
+            // Show the total number of frames and calculate the FPS by deviding it by the total scan time
+            syslog(LOG_INFO, "\nFrames searched: %d (%.2f fps)", pipeline.frames(), pipeline.frames() / search_time.count());
+            syslog(LOG_INFO, "Black frames ignored: %d ", pipeline.black_frames());
+            syslog(LOG_INFO, "Dark frames ignored: %d ", pipeline.dark_frames());
+            syslog(LOG_INFO, "Detection scans: %d full frame, %d tracked region", pipeline.tracker().full_scans(), pipeline.tracker().region_scans());
+            if (auto *cascade = dynamic_cast<cascade_face_detection_model *>(&recognition.face_detector()))
+                syslog(LOG_INFO, "Cascade: %d confirmed, %d dropped, %d CNN frame searches", cascade->confirmed(), cascade->dropped(), cascade->fallback_scans());
+            syslog(LOG_INFO, "Upsample level of winning frame: %d", found.upsample);
+            syslog(LOG_INFO, "Faces rejected before encoding: %d", pipeline.quality().rejections());
+            syslog(LOG_INFO, "Descriptors reused from earlier frames: %d of %d", pipeline.descriptors().hits(), pipeline.descriptors().lookups());
+            syslog(LOG_INFO, "Full frame conversions: %ld", image_context::conversions());
+            syslog(LOG_INFO, "Face encoder: %s", recognition.face_encoder().engine().c_str());
+            syslog(LOG_INFO, "Certainty of winning frame: %.3f", match * 10);
+
+            size_t winning_model = models.model_of(match_index);
+            syslog(LOG_INFO, "Winning model: %d (\"%s\")", models.id(winning_model), models.label(winning_model).c_str());
+        }
+        // Make snapshot if enabled
+        if (capture_successful)
+        {
+            make_snapshot("SUCCESSFUL");
         }
-        if (exposure != -1)
+
+        save_trace();
+
+        // Run rubberstamps if enabled
+        if (config.GetBoolean("rubberstamps", "enabled", false))
         {
-            // For a strange reason on some cameras (e.g. Lenoxo X1E) setting manual exposure works only after a couple frames
-            // are captured and even after a delay it does not always work. Setting exposure at every frame is reliable though.
-            video_capture.set(cv::CAP_PROP_AUTO_EXPOSURE, 1.0); // 1 = Manual
-            video_capture.set(cv::CAP_PROP_EXPOSURE, double(exposure));
+            OpenCV opencv(video_capture, recognition.face_detector(), recognition.pose_predictor(), cv::createCLAHE(2.0, cv::Size(8, 8)));
+            execute(config, gtk_proc, opencv);
+
+            send_to_ui("S", "");
         }
+
+        // End peacefully
+        exit(0);
     }
-}
\ No newline at end of file
+}
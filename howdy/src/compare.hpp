@@ -0,0 +1,15 @@
+#ifndef COMPARE_H_
+#define COMPARE_H_
+
+#include <string>
+
+#include "models.hpp"
+
+/*
+Runs a full authentication attempt for the given user and exits the process
+with the result as its status code. Models that are not loaded yet are loaded
+first, so callers that keep them around can skip that step.
+*/
+[[noreturn]] void compare(const std::string &username, recognition_models &recognition);
+
+#endif // COMPARE_H_
@@ -0,0 +1,106 @@
+#include <cmath>
+
+#include <dlib/opencv.h>
+#include <dlib/image_transforms.h>
+
+#include "descriptor_cache.hpp"
+
+// Faces remembered at once, more than one in front of the camera is rare
+const size_t CACHE_SIZE = 4;
+// Side of the thumbnail compared between frames
+const long THUMBNAIL_SIZE = 16;
+
+descriptor_cache::descriptor_cache(INIReader &config)
+{
+    max_shift = config.GetReal("video", "reuse_max_shift", 0.05);
+    max_change = config.GetReal("video", "reuse_max_change", 3);
+}
+
+descriptor_cache::key descriptor_cache::make_key(const dlib::full_object_detection &face, const cv::Mat &gsframe) const
+{
+    key result;
+    for (unsigned long i = 0; i < face.num_parts(); i++)
+        result.landmarks.push_back(face.part(i));
+
+    result.eye_distance = face.num_parts() >= 3 ? double((face.part(0) - face.part(2)).length()) : double(face.get_rect().width());
+
+    // The same alignment as the encoder uses, only much smaller
+    dlib::chip_details details = dlib::get_face_chip_details(face, 150, 0.25);
+    details.rows = THUMBNAIL_SIZE;
+    details.cols = THUMBNAIL_SIZE;
+    dlib::extract_image_chip(dlib::cv_image<unsigned char>(gsframe), details, result.thumbnail);
+
+    return result;
+}
+
+bool descriptor_cache::matches(const key &a, const key &b) const
+{
+    if (a.landmarks.size() != b.landmarks.size() || a.thumbnail.size() != b.thumbnail.size())
+        return false;
+
+    // The chips are aligned on the landmarks, so moving the whole face does
+    // not change what the encoder sees. Only the shape of the landmarks around
+    // their centre counts, relative to the size of the face
+    dlib::dpoint centre_a, centre_b;
+    for (size_t i = 0; i < a.landmarks.size(); i++)
+    {
+        centre_a += dlib::dpoint(a.landmarks[i]);
+        centre_b += dlib::dpoint(b.landmarks[i]);
+    }
+    dlib::dpoint moved = (centre_a - centre_b) / double(std::max<size_t>(a.landmarks.size(), 1));
+
+    double allowed = max_shift * std::max(a.eye_distance, 1.0);
+    for (size_t i = 0; i < a.landmarks.size(); i++)
+    {
+        if ((dlib::dpoint(a.landmarks[i] - b.landmarks[i]) - moved).length() > allowed)
+            return false;
+    }
+
+    // The face itself changed, by expression or lighting
+    double change = dlib::mean(dlib::abs(dlib::matrix_cast<double>(a.thumbnail) - dlib::matrix_cast<double>(b.thumbnail)));
+    return change <= max_change;
+}
+
+bool descriptor_cache::lookup(const key &face, dlib::matrix<double, 0, 1> &descriptor)
+{
+    if (!enabled())
+        return false;
+
+    lookup_count++;
+    for (auto &ent : entries)
+    {
+        if (matches(face, ent.face))
+        {
+            descriptor = ent.descriptor;
+            hit_count++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void descriptor_cache::store(const key &face, const dlib::matrix<double, 0, 1> &descriptor)
+{
+    if (!enabled())
+        return;
+
+    entries.push_front(entry{face, descriptor});
+    if (entries.size() > CACHE_SIZE)
+        entries.pop_back();
+}
+
+bool descriptor_cache::enabled() const
+{
+    return max_change > 0 && max_shift > 0;
+}
+
+int descriptor_cache::hits() const
+{
+    return hit_count;
+}
+
+int descriptor_cache::lookups() const
+{
+    return lookup_count;
+}
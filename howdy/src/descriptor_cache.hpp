@@ -0,0 +1,80 @@
+#ifndef DESCRIPTOR_CACHE_H_
+#define DESCRIPTOR_CACHE_H_
+
+#include <deque>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include <INIReader.h>
+
+#include <dlib/matrix.h>
+#include <dlib/image_processing/full_object_detection.h>
+
+/*
+Remembers the descriptors of the last few faces, so a face that did not move
+or change between frames does not have to go through the network again.
+
+Faces are compared by their landmarks and by a 16x16 grayscale thumbnail of
+the aligned face chip. If the landmarks changed their shape less than
+reuse_max_shift of the eye distance and the thumbnail changed less than
+reuse_max_change gray levels on average, the stored descriptor is used.
+
+Moving the whole face is free, the chip is aligned on the landmarks and
+comes out the same. Anything that does change the chip, turning the head,
+an expression or different lighting, shows in the thumbnail.
+*/
+class descriptor_cache
+{
+public:
+    // What a face is recognised by
+    struct key
+    {
+        std::vector<dlib::point> landmarks;
+        double eye_distance;
+        dlib::matrix<unsigned char> thumbnail;
+    };
+
+    descriptor_cache(INIReader &config);
+
+    /*
+    Builds the key of a face found in gsframe
+    */
+    key make_key(const dlib::full_object_detection &face, const cv::Mat &gsframe) const;
+
+    /*
+    Sets descriptor and returns true if a close enough face is stored
+    */
+    bool lookup(const key &face, dlib::matrix<double, 0, 1> &descriptor);
+
+    /*
+    Stores the descriptor of a face, replacing the oldest one when full
+    */
+    void store(const key &face, const dlib::matrix<double, 0, 1> &descriptor);
+
+    bool enabled() const;
+
+    /*
+    Number of descriptors reused so far, out of the faces looked up
+    */
+    int hits() const;
+    int lookups() const;
+
+private:
+    struct entry
+    {
+        key face;
+        dlib::matrix<double, 0, 1> descriptor;
+    };
+
+    bool matches(const key &a, const key &b) const;
+
+    double max_shift;
+    double max_change;
+
+    std::deque<entry> entries;
+    int hit_count = 0;
+    int lookup_count = 0;
+};
+
+#endif // DESCRIPTOR_CACHE_H_
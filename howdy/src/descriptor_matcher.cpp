@@ -0,0 +1,163 @@
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCHER_X86
+#endif
+
+#include "descriptor_matcher.hpp"
+#include "descriptor_matcher_kernels.hpp"
+
+// Squared distances are compared, the root is only taken of the winner
+namespace matcher_kernels
+{
+    descriptor_match match_scalar(const float *descriptors, size_t count, const float *query)
+    {
+        descriptor_match best = {0, std::numeric_limits<float>::infinity()};
+
+        for (size_t row = 0; row < count; row++)
+        {
+            const float *descriptor = descriptors + row * DESCRIPTOR_SIZE;
+
+            // Four independent sums so the compiler can keep the pipeline full
+            float sums[4] = {0, 0, 0, 0};
+            for (int i = 0; i < DESCRIPTOR_SIZE; i += 4)
+            {
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    float diff = descriptor[i + lane] - query[i + lane];
+                    sums[lane] += diff * diff;
+                }
+            }
+
+            float distance = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+            if (distance < best.distance)
+                best = {row, distance};
+        }
+
+        return best;
+    }
+
+#ifdef MATCHER_X86
+    __attribute__((target("avx2,fma"))) descriptor_match match_avx2(const float *descriptors, size_t count, const float *query)
+    {
+        descriptor_match best = {0, std::numeric_limits<float>::infinity()};
+
+        // The query stays in registers for the whole pass, 16 of 8 floats
+        __m256 q[DESCRIPTOR_SIZE / 8];
+        for (int i = 0; i < DESCRIPTOR_SIZE / 8; i++)
+            q[i] = _mm256_loadu_ps(query + i * 8);
+
+        for (size_t row = 0; row < count; row++)
+        {
+            const float *descriptor = descriptors + row * DESCRIPTOR_SIZE;
+
+            __m256 acc0 = _mm256_setzero_ps();
+            __m256 acc1 = _mm256_setzero_ps();
+            for (int i = 0; i < DESCRIPTOR_SIZE / 8; i += 2)
+            {
+                __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(descriptor + i * 8), q[i]);
+                __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(descriptor + i * 8 + 8), q[i + 1]);
+                acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+                acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+            }
+
+            // Horizontal sum of the 8 lanes
+            __m256 acc = _mm256_add_ps(acc0, acc1);
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+
+            float distance = _mm_cvtss_f32(sum);
+            if (distance < best.distance)
+                best = {row, distance};
+        }
+
+        return best;
+    }
+
+    __attribute__((target("avx512f"))) descriptor_match match_avx512(const float *descriptors, size_t count, const float *query)
+    {
+        descriptor_match best = {0, std::numeric_limits<float>::infinity()};
+
+        __m512 q[DESCRIPTOR_SIZE / 16];
+        for (int i = 0; i < DESCRIPTOR_SIZE / 16; i++)
+            q[i] = _mm512_loadu_ps(query + i * 16);
+
+        for (size_t row = 0; row < count; row++)
+        {
+            const float *descriptor = descriptors + row * DESCRIPTOR_SIZE;
+
+            __m512 acc0 = _mm512_setzero_ps();
+            __m512 acc1 = _mm512_setzero_ps();
+            for (int i = 0; i < DESCRIPTOR_SIZE / 16; i += 2)
+            {
+                __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(descriptor + i * 16), q[i]);
+                __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(descriptor + i * 16 + 16), q[i + 1]);
+                acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+                acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+            }
+
+            // Fold the 16 lanes in two 8 lane halves, then finish like the AVX2 version
+            alignas(64) float lanes[16];
+            _mm512_store_ps(lanes, _mm512_add_ps(acc0, acc1));
+            __m256 acc = _mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8));
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+
+            float distance = _mm_cvtss_f32(sum);
+            if (distance < best.distance)
+                best = {row, distance};
+        }
+
+        return best;
+    }
+#endif
+
+    std::vector<kernel> supported()
+    {
+        std::vector<kernel> kernels{{match_scalar, "scalar"}};
+#ifdef MATCHER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            kernels.push_back({match_avx2, "avx2"});
+        if (__builtin_cpu_supports("avx512f"))
+            kernels.push_back({match_avx512, "avx512"});
+#endif
+        return kernels;
+    }
+}
+
+namespace
+{
+    // Picked once per process, the CPU doesn't change under us
+    const matcher_kernels::kernel &selected()
+    {
+        static const matcher_kernels::kernel chosen = matcher_kernels::supported().back();
+        return chosen;
+    }
+}
+
+static_assert(DESCRIPTOR_SIZE % 32 == 0, "The vector loops expect whole blocks of 32 values");
+
+descriptor_matcher::descriptor_matcher(const float *descriptors, size_t count)
+    : descriptors(descriptors), count(count)
+{
+}
+
+descriptor_match descriptor_matcher::best_match(const float *query) const
+{
+    if (count == 0)
+        return {0, std::numeric_limits<float>::infinity()};
+
+    descriptor_match best = selected().match(descriptors, count, query);
+    best.distance = std::sqrt(best.distance);
+    return best;
+}
+
+const char *descriptor_matcher::instruction_set()
+{
+    return selected().name;
+}
@@ -0,0 +1,49 @@
+#ifndef DESCRIPTOR_MATCHER_H_
+#define DESCRIPTOR_MATCHER_H_
+
+#include <cstddef>
+
+#include "model_store.hpp"
+
+// The closest stored descriptor to a query
+struct descriptor_match
+{
+    size_t index;
+    float distance;
+};
+
+/*
+Finds the closest of a set of face descriptors to a query descriptor.
+
+The descriptors are read in place from a row-major float array with
+DESCRIPTOR_SIZE values per row, like the one a model_store maps. All
+distances are computed in a single vectorized pass, using AVX-512 or AVX2
+when the CPU has them and plain loops otherwise. Matching never allocates.
+*/
+class descriptor_matcher
+{
+public:
+    /*
+    The array has to outlive the matcher. Rows should be 64 byte aligned for
+    the best speed, but don't have to be.
+    */
+    descriptor_matcher(const float *descriptors, size_t count);
+
+    /*
+    Returns the index of the closest descriptor and its euclidean distance to
+    query, which has DESCRIPTOR_SIZE values. Without any descriptors the
+    distance is infinite.
+    */
+    descriptor_match best_match(const float *query) const;
+
+    /*
+    Name of the instruction set picked for this CPU
+    */
+    static const char *instruction_set();
+
+private:
+    const float *descriptors;
+    size_t count;
+};
+
+#endif // DESCRIPTOR_MATCHER_H_
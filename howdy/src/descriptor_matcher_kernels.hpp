@@ -0,0 +1,39 @@
+#ifndef DESCRIPTOR_MATCHER_KERNELS_H_
+#define DESCRIPTOR_MATCHER_KERNELS_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "descriptor_matcher.hpp"
+
+/*
+The matching loops behind descriptor_matcher, one per instruction set.
+
+Only descriptor_matcher and the match bench use these, the bench to check
+every kernel the CPU can run against the same reference. A kernel returns
+the squared distance of the closest descriptor, count has to be at least 1.
+*/
+namespace matcher_kernels
+{
+    using match_function = descriptor_match (*)(const float *descriptors, size_t count, const float *query);
+
+    struct kernel
+    {
+        match_function match;
+        const char *name;
+    };
+
+    descriptor_match match_scalar(const float *descriptors, size_t count, const float *query);
+
+#if defined(__x86_64__) || defined(__i386__)
+    descriptor_match match_avx2(const float *descriptors, size_t count, const float *query);
+    descriptor_match match_avx512(const float *descriptors, size_t count, const float *query);
+#endif
+
+    /*
+    The kernels this CPU can run, from the slowest to the fastest
+    */
+    std::vector<kernel> supported();
+}
+
+#endif // DESCRIPTOR_MATCHER_KERNELS_H_
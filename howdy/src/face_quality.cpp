@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cmath>
+
+#include <opencv2/imgproc.hpp>
+
+#include "face_quality.hpp"
+
+face_quality_gate::face_quality_gate(INIReader &config)
+{
+    min_eye_distance = config.GetReal("video", "quality_min_eye_distance", 12);
+    max_roll = config.GetReal("video", "quality_max_roll", 30);
+    min_visible = config.GetReal("video", "quality_min_visible", 0.9);
+    min_sharpness = config.GetReal("video", "quality_min_sharpness", 0);
+}
+
+bool face_quality_gate::accept(const dlib::full_object_detection &face, const cv::Mat &gsframe)
+{
+    // Only the 5 point model is used by howdy, let anything else through
+    if (face.num_parts() != 5)
+        return true;
+
+    // Points 0 and 1 are the corners of one eye, 2 and 3 of the other, 4 is the nose
+    double left_x = (face.part(0).x() + face.part(1).x()) / 2.0;
+    double left_y = (face.part(0).y() + face.part(1).y()) / 2.0;
+    double right_x = (face.part(2).x() + face.part(3).x()) / 2.0;
+    double right_y = (face.part(2).y() + face.part(3).y()) / 2.0;
+
+    // Too small to tell faces apart
+    double eye_distance = std::hypot(left_x - right_x, left_y - right_y);
+    if (eye_distance < min_eye_distance)
+    {
+        rejected++;
+        return false;
+    }
+
+    // Head tilted too far to the side
+    double roll = std::abs(std::atan2(left_y - right_y, left_x - right_x) * 180 / M_PI);
+    roll = std::min(roll, 180 - roll);
+    if (roll > max_roll)
+    {
+        rejected++;
+        return false;
+    }
+
+    // Too much of the face is outside of the frame
+    const dlib::rectangle &box = face.get_rect();
+    cv::Rect face_box(box.left(), box.top(), box.width(), box.height());
+    cv::Rect visible = face_box & cv::Rect(0, 0, gsframe.cols, gsframe.rows);
+    if (face_box.area() <= 0 || double(visible.area()) / face_box.area() < min_visible)
+    {
+        rejected++;
+        return false;
+    }
+
+    // Blurred by motion or out of focus, only measured around the eyes and nose
+    if (min_sharpness > 0)
+    {
+        long left = std::min({face.part(0).x(), face.part(2).x(), face.part(4).x()});
+        long right = std::max({face.part(0).x(), face.part(2).x(), face.part(4).x()});
+        long top = std::min({face.part(0).y(), face.part(2).y(), face.part(4).y()});
+        long bottom = std::max({face.part(0).y(), face.part(2).y(), face.part(4).y()});
+
+        cv::Rect region = cv::Rect(left, top, right - left + 1, bottom - top + 1) & cv::Rect(0, 0, gsframe.cols, gsframe.rows);
+        if (region.width < 3 || region.height < 3)
+        {
+            rejected++;
+            return false;
+        }
+
+        cv::Mat laplacian;
+        cv::Laplacian(gsframe(region), laplacian, CV_16S);
+
+        cv::Scalar mean, stddev;
+        cv::meanStdDev(laplacian, mean, stddev);
+        if (stddev[0] * stddev[0] < min_sharpness)
+        {
+            rejected++;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int face_quality_gate::rejections() const
+{
+    return rejected;
+}
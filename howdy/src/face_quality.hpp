@@ -0,0 +1,44 @@
+#ifndef FACE_QUALITY_H_
+#define FACE_QUALITY_H_
+
+#include <opencv2/core.hpp>
+
+#include <INIReader.h>
+
+#include <dlib/image_processing/full_object_detection.h>
+
+/*
+Cheap checks on a detected face, to skip encoding faces that could never
+match anyway.
+
+Uses the 5 point landmarks for the distance between the eyes and the roll
+of the head, the detection box for how much of the face is inside the
+frame, and the variance of the Laplacian around the eyes and nose for
+sharpness. Thresholds come from the [video] section of the config.
+*/
+class face_quality_gate
+{
+public:
+    face_quality_gate(INIReader &config);
+
+    /*
+    True if the face is good enough to encode. gsframe is the grayscale frame
+    the landmarks were found in.
+    */
+    bool accept(const dlib::full_object_detection &face, const cv::Mat &gsframe);
+
+    /*
+    Number of faces rejected so far
+    */
+    int rejections() const;
+
+private:
+    double min_eye_distance;
+    double max_roll;
+    double min_visible;
+    double min_sharpness;
+
+    int rejected = 0;
+};
+
+#endif // FACE_QUALITY_H_
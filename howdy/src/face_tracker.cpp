@@ -0,0 +1,80 @@
+#include <algorithm>
+
+#include "face_tracker.hpp"
+
+namespace
+{
+    /*Follow the largest face, the one closest to the camera*/
+    const rectangle &largest(const std::vector<rectangle> &faces)
+    {
+        return *std::max_element(faces.begin(), faces.end(), [](const rectangle &a, const rectangle &b)
+                                 { return a.area() < b.area(); });
+    }
+}
+
+face_tracker::face_tracker(int full_scan_interval, double padding)
+    : full_scan_interval(full_scan_interval), padding(padding)
+{
+}
+
+std::vector<rectangle> face_tracker::detect(face_detection_model &detector, cv::Mat &gsframe, const int upsample_num_times)
+{
+    if (!tracking || full_scan_interval <= 1 || frames_since_scan >= full_scan_interval - 1)
+        return scan_full(detector, gsframe, upsample_num_times);
+
+    frames_since_scan++;
+    region_scan_count++;
+
+    // Pad the last box on every side and keep it inside the frame
+    long pad_x = long(last_face.width() * padding);
+    long pad_y = long(last_face.height() * padding);
+    cv::Rect region = cv::Rect(last_face.left() - pad_x, last_face.top() - pad_y, last_face.width() + 2 * pad_x, last_face.height() + 2 * pad_y) & cv::Rect(0, 0, gsframe.cols, gsframe.rows);
+
+    if (region.empty())
+        return scan_full(detector, gsframe, upsample_num_times);
+
+    // Only a view, the pixels are not copied
+    cv::Mat roi = gsframe(region);
+    std::vector<rectangle> faces = detector(roi, upsample_num_times);
+
+    // The face moved out of the region or is gone, look at everything again
+    if (faces.empty())
+        return scan_full(detector, gsframe, upsample_num_times);
+
+    // Move the boxes back into frame coordinates
+    for (auto &face : faces)
+        face = translate_rect(face, point(region.x, region.y));
+
+    last_face = largest(faces);
+    return faces;
+}
+
+std::vector<rectangle> face_tracker::scan_full(face_detection_model &detector, cv::Mat &gsframe, const int upsample_num_times)
+{
+    full_scan_count++;
+    frames_since_scan = 0;
+
+    std::vector<rectangle> faces = detector(gsframe, upsample_num_times);
+
+    tracking = !faces.empty();
+    if (tracking)
+        last_face = largest(faces);
+
+    return faces;
+}
+
+void face_tracker::reset()
+{
+    tracking = false;
+    frames_since_scan = 0;
+}
+
+int face_tracker::full_scans() const
+{
+    return full_scan_count;
+}
+
+int face_tracker::region_scans() const
+{
+    return region_scan_count;
+}
@@ -0,0 +1,60 @@
+#ifndef FACE_TRACKER_H_
+#define FACE_TRACKER_H_
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "models.hpp"
+
+/*
+Cuts down on full frame face detection between consecutive frames.
+
+Once a face has been found, the following frames are only searched in a
+padded region around the last box. The whole frame is scanned again every
+full_scan_interval frames, or as soon as the face is no longer found in its
+region.
+*/
+class face_tracker
+{
+public:
+    /*
+    full_scan_interval is the number of frames between full frame scans while
+    a face is tracked, 1 or lower turns tracking off. padding is the space
+    added around the last box on every side, relative to its size.
+    */
+    face_tracker(int full_scan_interval, double padding);
+
+    /*
+    Finds the faces in gsframe, upsampled upsample_num_times like the
+    detector itself does. Frames have to keep the same size and orientation
+    while a face is tracked, call reset() when they don't.
+    */
+    std::vector<rectangle> detect(face_detection_model &detector, cv::Mat &gsframe, const int upsample_num_times);
+
+    /*
+    Forget the tracked face, the next frame gets a full scan
+    */
+    void reset();
+
+    /*
+    Number of full frame and region scans done
+    */
+    int full_scans() const;
+    int region_scans() const;
+
+private:
+    std::vector<rectangle> scan_full(face_detection_model &detector, cv::Mat &gsframe, const int upsample_num_times);
+
+    int full_scan_interval;
+    double padding;
+
+    bool tracking = false;
+    rectangle last_face;
+    int frames_since_scan = 0;
+
+    int full_scan_count = 0;
+    int region_scan_count = 0;
+};
+
+#endif // FACE_TRACKER_H_
@@ -0,0 +1,138 @@
+#include <cstring>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "frame_dump.hpp"
+
+bool frame_dump_reader::open(const std::string &path)
+{
+    file.open(path, std::ios::binary);
+    if (!file.read((char *)&info, sizeof(info)))
+        return false;
+
+    if (std::memcmp(info.magic, FRAME_DUMP_MAGIC, sizeof(FRAME_DUMP_MAGIC)) != 0 || info.version != FRAME_DUMP_VERSION)
+        return false;
+
+    if (info.compression != FRAME_DUMP_UNCOMPRESSED && !(info.compression == FRAME_DUMP_LZ4 && frame_dump_writer::has_lz4()))
+        return false;
+
+    return info.width > 0 && info.height > 0 && (info.type == CV_8UC1 || info.type == CV_8UC3);
+}
+
+bool frame_dump_reader::read(cv::Mat &frame, double &seconds)
+{
+    int64_t microseconds;
+    uint32_t size;
+    if (!file.read((char *)&microseconds, sizeof(microseconds)) || !file.read((char *)&size, sizeof(size)))
+        return false;
+
+    // A new matrix every frame, the ones handed out before may still be in use
+    frame.create(info.height, info.width, info.type);
+    size_t frame_size = frame.total() * frame.elemSize();
+
+    if (info.compression == FRAME_DUMP_UNCOMPRESSED)
+    {
+        if (size != frame_size || !file.read((char *)frame.data, size))
+            return false;
+    }
+    else
+    {
+        packed.resize(size);
+        if (!file.read(packed.data(), size))
+            return false;
+
+#ifdef HAVE_LZ4
+        if (LZ4_decompress_safe(packed.data(), (char *)frame.data, size, frame_size) != int(frame_size))
+            return false;
+#else
+        return false;
+#endif
+    }
+
+    seconds = microseconds / 1e6;
+    return true;
+}
+
+const frame_dump_header &frame_dump_reader::header() const
+{
+    return info;
+}
+
+bool frame_dump_reader::is_dump(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(FRAME_DUMP_MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, FRAME_DUMP_MAGIC, sizeof(magic)) == 0;
+}
+
+bool frame_dump_writer::open(const std::string &path, const frame_dump_header &header)
+{
+    if (header.compression != FRAME_DUMP_UNCOMPRESSED && !(header.compression == FRAME_DUMP_LZ4 && has_lz4()))
+        return false;
+
+    info = header;
+    std::memcpy(info.magic, FRAME_DUMP_MAGIC, sizeof(FRAME_DUMP_MAGIC));
+    info.version = FRAME_DUMP_VERSION;
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    file.write((const char *)&info, sizeof(info));
+    written = sizeof(info);
+    return bool(file);
+}
+
+bool frame_dump_writer::write(const cv::Mat &frame, double seconds)
+{
+    if (frame.rows != info.height || frame.cols != info.width || frame.type() != info.type)
+        return false;
+
+    // Frames of the v4l2 plugin can have padded rows
+    const cv::Mat *pixels = &frame;
+    if (!frame.isContinuous())
+    {
+        frame.copyTo(continuous);
+        pixels = &continuous;
+    }
+
+    const char *data = (const char *)pixels->data;
+    uint32_t size = pixels->total() * pixels->elemSize();
+
+#ifdef HAVE_LZ4
+    if (info.compression == FRAME_DUMP_LZ4)
+    {
+        packed.resize(LZ4_compressBound(size));
+        size = LZ4_compress_default(data, packed.data(), size, packed.size());
+        if (size == 0)
+            return false;
+        data = packed.data();
+    }
+#endif
+
+    int64_t microseconds = int64_t(seconds * 1e6);
+    file.write((const char *)&microseconds, sizeof(microseconds));
+    file.write((const char *)&size, sizeof(size));
+    file.write(data, size);
+    written += sizeof(microseconds) + sizeof(size) + size;
+    return bool(file);
+}
+
+size_t frame_dump_writer::size() const
+{
+    return written;
+}
+
+bool frame_dump_writer::close()
+{
+    file.close();
+    return !file.fail();
+}
+
+bool frame_dump_writer::has_lz4()
+{
+#ifdef HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,116 @@
+#ifndef FRAME_DUMP_H_
+#define FRAME_DUMP_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+/*
+Raw camera frames in a file, one after the other, to replay them later
+exactly as they were captured.
+
+The file starts with a frame_dump_header. Every frame follows as its time
+since the first frame in microseconds (int64), the size of its data in bytes
+(uint32) and the data: the pixels row after row without padding, packed
+with LZ4 if the header says so.
+*/
+struct frame_dump_header
+{
+    char magic[8];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    // OpenCV type of the frames, CV_8UC1 or CV_8UC3
+    int32_t type;
+    // How the pixels of a frame are packed, FRAME_DUMP_UNCOMPRESSED or FRAME_DUMP_LZ4
+    uint32_t compression;
+    // Pixel format the camera delivered, as a four character code
+    uint32_t fourcc;
+    // The frame_width and frame_height asked for, -1 if none was
+    int32_t requested_width;
+    int32_t requested_height;
+    // Exposure the camera reported when the recording started
+    double exposure;
+};
+
+const char FRAME_DUMP_MAGIC[8] = {'H', 'O', 'W', 'D', 'Y', 'F', 'D', '\0'};
+const uint32_t FRAME_DUMP_VERSION = 1;
+
+// Values of frame_dump_header::compression
+const uint32_t FRAME_DUMP_UNCOMPRESSED = 0;
+const uint32_t FRAME_DUMP_LZ4 = 1;
+
+/*
+Reads the frames of a dump in order
+*/
+class frame_dump_reader
+{
+public:
+    /*
+    Returns false if the file is not a frame dump this build can read
+    */
+    bool open(const std::string &path);
+
+    /*
+    Reads the next frame and the time it was captured at, relative to the
+    first frame. Returns false at the end of the file.
+    */
+    bool read(cv::Mat &frame, double &seconds);
+
+    const frame_dump_header &header() const;
+
+    /*
+    Whether a file starts like a frame dump, without reading any further
+    */
+    static bool is_dump(const std::string &path);
+
+private:
+    std::ifstream file;
+    frame_dump_header info = {};
+    // Packed data of the last frame
+    std::vector<char> packed;
+};
+
+/*
+Writes frames to a new dump. Not thread safe, a recording has one writer.
+*/
+class frame_dump_writer
+{
+public:
+    /*
+    Creates the file and writes the header, which has to describe the
+    frames that follow. Returns false if the file can't be written or the
+    header asks for a compression this build does not have.
+    */
+    bool open(const std::string &path, const frame_dump_header &header);
+
+    /*
+    Appends a frame captured the given time after the first one
+    */
+    bool write(const cv::Mat &frame, double seconds);
+
+    /*
+    Bytes written so far, header included
+    */
+    size_t size() const;
+
+    bool close();
+
+    /*
+    Whether this build can pack frames with LZ4
+    */
+    static bool has_lz4();
+
+private:
+    std::ofstream file;
+    frame_dump_header info = {};
+    size_t written = 0;
+    // Pixels of a frame without padding, and those packed
+    cv::Mat continuous;
+    std::vector<char> packed;
+};
+
+#endif // FRAME_DUMP_H_
@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <cmath>
+
+#include "frame_preprocessor.hpp"
+#include "trace.hpp"
+
+namespace
+{
+    /*Gray value of a BGR pixel, with the fixed point weights of cv::cvtColor, at most one level off*/
+    inline unsigned char gray_of(const unsigned char *bgr)
+    {
+        return (unsigned char)((bgr[0] * 1868 + bgr[1] * 9617 + bgr[2] * 4899 + (1 << 13)) >> 14);
+    }
+
+    /*Index of a pixel past the edge, mirrored without repeating the edge like BORDER_REFLECT_101*/
+    int mirror(int index, int size)
+    {
+        if (size == 1)
+            return 0;
+        while (index < 0 || index >= size)
+            index = index < 0 ? -index : 2 * size - 2 - index;
+        return index;
+    }
+
+    /*A buffer of the pool no other stage holds on to anymore, or a new one*/
+    cv::Mat &free_buffer(std::vector<cv::Mat> &pool)
+    {
+        for (cv::Mat &buffer : pool)
+        {
+            // Only the pool itself refers to it
+            if (buffer.u && CV_XADD(&buffer.u->refcount, 0) == 1)
+                return buffer;
+        }
+
+        // Grows to the number of frames in flight, a handful
+        pool.emplace_back();
+        return pool.back();
+    }
+}
+
+frame_preprocessor::frame_preprocessor(double scaling_factor, cv::Ptr<cv::CLAHE> clahe)
+    : scaling_factor(scaling_factor), clip_limit(clahe->getClipLimit()), tiles(clahe->getTilesGridSize())
+{
+}
+
+double frame_preprocessor::measure(const cv::Mat &raw)
+{
+    if (raw.empty() || raw.depth() != CV_8U || (raw.channels() != 1 && raw.channels() != 3))
+        return 100;
+
+    int stride = sample_stride();
+    int channels = raw.channels();
+    raw_size = raw.size();
+    cv::Size padded = padded_size(raw_size);
+    int width = padded.width;
+    int height = padded.height;
+    tile_width = width / tiles.width;
+    tile_height = height / tiles.height;
+
+    // Where every sampled column comes from, and how many samples each tile gets
+    std::vector<int> column_tiles;
+    std::vector<int> column_counts(tiles.width, 0);
+    std::vector<int> row_counts(tiles.height, 0);
+    sample_columns.clear();
+    for (int x = 0; x < width; x += stride)
+    {
+        sample_columns.push_back(mirror(x, raw.cols) * channels);
+        column_tiles.push_back(x / tile_width);
+        column_counts[x / tile_width]++;
+    }
+
+    histograms.assign(tiles.area(), {});
+    samples.create((raw.rows + stride - 1) / stride, (raw.cols + stride - 1) / stride, CV_8UC1);
+
+    for (int y = 0; y < height; y += stride)
+    {
+        const unsigned char *row = raw.ptr<unsigned char>(mirror(y, raw.rows));
+        std::array<int, 256> *tile_row = &histograms[(y / tile_height) * tiles.width];
+        row_counts[y / tile_height]++;
+
+        // Samples inside the frame are kept for the darkness below
+        unsigned char *sample_row = y < raw.rows ? samples.ptr<unsigned char>(y / stride) : nullptr;
+        int inside = sample_row ? samples.cols : 0;
+
+        for (size_t i = 0; i < sample_columns.size(); i++)
+        {
+            const unsigned char *pixel = row + sample_columns[i];
+            unsigned char value = channels == 1 ? pixel[0] : gray_of(pixel);
+            tile_row[column_tiles[i]][value]++;
+            if (int(i) < inside)
+                sample_row[i] = value;
+        }
+    }
+
+    build_tables(row_counts, column_counts);
+
+    // The darkness of the samples after CLAHE, standing in for the full frame
+    prepare_columns(samples.cols, stride, 0);
+    size_t dark = 0;
+    for (int y = 0; y < samples.rows; y++)
+        apply_row(samples.ptr<unsigned char>(y), nullptr, samples.cols, float(y * stride), &dark);
+
+    return double(dark) / samples.total() * 100;
+}
+
+double frame_preprocessor::dark_bound(const cv::Mat &raw)
+{
+    if (raw.empty() || raw.depth() != CV_8U || (raw.channels() != 1 && raw.channels() != 3))
+        return 100;
+
+    int stride = sample_stride();
+    int limit = dark_limit(raw.size(), stride);
+    if (limit == 0)
+        return 0;
+
+    // The samples measure() reads inside the frame, gathered so they can be counted in one pass
+    const cv::Mat *sampled = &raw;
+    if (stride > 1)
+    {
+        int channels = raw.channels();
+        raw_samples.create((raw.rows + stride - 1) / stride, (raw.cols + stride - 1) / stride, raw.type());
+        for (int y = 0; y < raw_samples.rows; y++)
+        {
+            const unsigned char *row = raw.ptr<unsigned char>(y * stride);
+            unsigned char *out = raw_samples.ptr<unsigned char>(y);
+            for (int x = 0; x < raw_samples.cols; x++)
+            {
+                for (int c = 0; c < channels; c++)
+                    out[x * channels + c] = row[x * stride * channels + c];
+            }
+        }
+        sampled = &raw_samples;
+    }
+
+    // A pixel is dark if all of its channels are, which also holds for its gray
+    // value. Both are vectorized
+    cv::inRange(*sampled, cv::Scalar::all(0), cv::Scalar::all(limit - 1), dark_mask);
+    return double(cv::countNonZero(dark_mask)) / dark_mask.total() * 100;
+}
+
+void frame_preprocessor::enhance(const cv::Mat &raw, cv::Mat &frame, cv::Mat &gsframe)
+{
+    // The tables have to be made for a frame of this size
+    if (raw.size() != raw_size)
+        measure(raw);
+
+    // Raw frames can be views of capture buffers that are reused on the next
+    // read, so the frame handed on always gets its own memory
+    cv::Mat &small = free_buffer(frame_pool);
+    {
+        trace::span span("resize");
+        if (scaling_factor != 1)
+            cv::resize(raw, small, cv::Size(), scaling_factor, scaling_factor, cv::INTER_AREA);
+        else
+            raw.copyTo(small);
+    }
+
+    trace::span span("clahe");
+    cv::Mat &enhanced = free_buffer(gsframe_pool);
+    enhanced.create(small.size(), CV_8UC1);
+
+    // Pixel centres of the small frame in the raw frame, where the tables are laid out
+    double spacing = 1 / scaling_factor;
+    double offset = spacing / 2 - 0.5;
+    prepare_columns(small.cols, spacing, offset);
+
+    // Gray conversion and CLAHE one row at a time, while the row is in cache
+    gray_row.resize(small.cols);
+    for (int y = 0; y < small.rows; y++)
+    {
+        const unsigned char *row = small.ptr<unsigned char>(y);
+        if (small.channels() == 3)
+        {
+            for (int x = 0; x < small.cols; x++)
+                gray_row[x] = gray_of(row + 3 * x);
+            row = gray_row.data();
+        }
+
+        apply_row(row, enhanced.ptr<unsigned char>(y), small.cols, float(y * spacing + offset), nullptr);
+    }
+
+    frame = small;
+    gsframe = enhanced;
+}
+
+/*Sample about as many pixels as the scaled down frame has*/
+int frame_preprocessor::sample_stride() const
+{
+    return std::max(1, int(1 / scaling_factor));
+}
+
+/*Size of a raw frame with the padding, the tiles divide it evenly*/
+cv::Size frame_preprocessor::padded_size(cv::Size size) const
+{
+    // OpenCV pads frames that don't divide into tiles evenly on the bottom and
+    // right, mirroring the edge, and the padding counts in the histograms
+    if (size.width % tiles.width != 0 || size.height % tiles.height != 0)
+    {
+        size.width += tiles.width - size.width % tiles.width;
+        size.height += tiles.height - size.height % tiles.height;
+    }
+    return size;
+}
+
+/*Raw values below the returned one come out of any table build_tables() can make under 32, the first histogram bin*/
+int frame_preprocessor::dark_limit(cv::Size size, int stride) const
+{
+    // Without clipping a single value can be stretched over the whole range
+    if (clip_limit <= 0)
+        return 0;
+
+    // The fewest samples a tile can get
+    cv::Size padded = padded_size(size);
+    int columns = padded.width / tiles.width / stride;
+    int rows = padded.height / tiles.height / stride;
+    double area = std::max(columns * rows, 1);
+
+    // After clipping and spreading what was cut off, and one more for the
+    // residual, no bin holds more than this share of the tile. It only grows
+    // for smaller tiles, so it holds for every tile
+    double share = std::max(clip_limit / 256, 1 / area) + 1.0 / 256 + 1 / area;
+
+    // A table maps v to at most (v + 1) * share * 255, rounded. Interpolating
+    // between the tables of neighbouring tiles can't exceed that
+    int limit = 0;
+    while (limit < 32 && (limit + 1) * share * 255 < 31.5)
+        limit++;
+    return limit;
+}
+
+/*Clip the tile histograms and turn them into lookup tables, the same way OpenCV's CLAHE does*/
+void frame_preprocessor::build_tables(const std::vector<int> &row_counts, const std::vector<int> &column_counts)
+{
+    tables.resize(histograms.size());
+
+    for (int ty = 0; ty < tiles.height; ty++)
+    {
+        for (int tx = 0; tx < tiles.width; tx++)
+        {
+            std::array<int, 256> &histogram = histograms[ty * tiles.width + tx];
+            std::array<unsigned char, 256> &table = tables[ty * tiles.width + tx];
+            int area = std::max(row_counts[ty] * column_counts[tx], 1);
+
+            if (clip_limit > 0)
+            {
+                int limit = std::max(int(clip_limit * area / 256), 1);
+                int clipped = 0;
+                for (int &count : histogram)
+                {
+                    if (count > limit)
+                    {
+                        clipped += count - limit;
+                        count = limit;
+                    }
+                }
+
+                // Spread what was cut off evenly, the rest one by one
+                int batch = clipped / 256;
+                int residual = clipped - batch * 256;
+                for (int &count : histogram)
+                    count += batch;
+                if (residual != 0)
+                {
+                    int step = std::max(256 / residual, 1);
+                    for (int i = 0; i < 256 && residual > 0; i += step, residual--)
+                        histogram[i]++;
+                }
+            }
+
+            float scale = 255.0f / area;
+            int sum = 0;
+            for (int i = 0; i < 256; i++)
+            {
+                sum += histogram[i];
+                table[i] = cv::saturate_cast<unsigned char>(sum * scale);
+            }
+        }
+    }
+}
+
+/*Tables to interpolate between for every column, pixel x sits at x * spacing + offset in the raw frame*/
+void frame_preprocessor::prepare_columns(int columns, double spacing, double offset)
+{
+    first_table.resize(columns);
+    second_table.resize(columns);
+    second_weight.resize(columns);
+
+    float inverse_width = 1.0f / tile_width;
+    for (int x = 0; x < columns; x++)
+    {
+        float position = float(x * spacing + offset) * inverse_width - 0.5f;
+        int first = int(std::floor(position));
+        second_weight[x] = position - first;
+        second_table[x] = std::min(first + 1, tiles.width - 1);
+        first_table[x] = std::max(first, 0);
+    }
+}
+
+/*Applies the tables to one row at raw height y, writes it to out and counts dark pixels if given*/
+void frame_preprocessor::apply_row(const unsigned char *gray, unsigned char *out, int columns, float y, size_t *dark)
+{
+    float position = y * (1.0f / tile_height) - 0.5f;
+    int first = int(std::floor(position));
+    float lower_weight = position - first;
+    float upper_weight = 1.0f - lower_weight;
+    const std::array<unsigned char, 256> *upper = &tables[std::max(first, 0) * tiles.width];
+    const std::array<unsigned char, 256> *lower = &tables[std::min(first + 1, tiles.height - 1) * tiles.width];
+
+    size_t dark_count = 0;
+    for (int x = 0; x < columns; x++)
+    {
+        unsigned char value = gray[x];
+        int left = first_table[x];
+        int right = second_table[x];
+        float right_weight = second_weight[x];
+        float left_weight = 1.0f - right_weight;
+
+        // Same order of operations as OpenCV, so unscaled frames match it exactly
+        float result = (upper[left][value] * left_weight + upper[right][value] * right_weight) * upper_weight +
+                       (lower[left][value] * left_weight + lower[right][value] * right_weight) * lower_weight;
+        unsigned char enhanced = cv::saturate_cast<unsigned char>(result);
+
+        if (out)
+            out[x] = enhanced;
+        dark_count += enhanced < 32;
+    }
+
+    if (dark)
+        *dark += dark_count;
+}
@@ -0,0 +1,108 @@
+#ifndef FRAME_PREPROCESSOR_H_
+#define FRAME_PREPROCESSOR_H_
+
+#include <array>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+/*
+Turns raw camera frames into the inputs of the detector and the encoder.
+
+Works like converting the full frame to gray, applying CLAHE, measuring the
+darkness and then scaling down, but without touching most of the full frame
+more than once:
+
+ - dark_bound() counts the samples measure() will read that are dark
+   enough to stay dark after any CLAHE, so the darkest frames can be
+   dropped before anything else is done with them.
+ - measure() reads every stride-th pixel of every stride-th row of the raw
+   frame, where stride is about the inverse of the scaling factor. From
+   those it builds the CLAHE tile histograms, so the tables spread contrast
+   like the ones of the full frame would, and measures the darkness. Frames
+   that are too dark can be dropped right after.
+ - enhance() scales the raw frame down, then converts every small pixel to
+   gray and applies the CLAHE tables in a single pass.
+
+With a scaling factor of 1 the result is the same as OpenCV's CLAHE. Scaled
+down, the enhanced frame is within a few gray levels of scaling down the
+enhanced full frame.
+
+Raw frames have to be 8 bit gray or BGR. The outputs come from a small pool
+and are reused once the other stages let go of them.
+*/
+class frame_preprocessor
+{
+public:
+    /*
+    scaling_factor is applied to both sides of the frame, 1 keeps its size.
+    Only the clip limit and tile grid of clahe are used.
+    */
+    frame_preprocessor(double scaling_factor, cv::Ptr<cv::CLAHE> clahe);
+
+    /*
+    Returns the percentage of the enhanced frame in the lowest 1/8 of the
+    histogram, or 100 for an empty frame or one that is not 8 bit gray or
+    BGR. Builds the CLAHE tables enhance() uses.
+    */
+    double measure(const cv::Mat &raw);
+
+    /*
+    A cheap first check before measure(). Returns the percentage of the
+    samples measure() would read that are dark enough to end up in the
+    lowest 1/8 whatever the CLAHE tables turn out to be. It never exceeds
+    what measure() returns for the same frame, so frames it finds black or
+    too dark can be dropped without building the tables.
+    */
+    double dark_bound(const cv::Mat &raw);
+
+    /*
+    Scales raw down into frame and writes the CLAHE enhanced grayscale image
+    to gsframe. raw has to be the frame last passed to measure().
+    */
+    void enhance(const cv::Mat &raw, cv::Mat &frame, cv::Mat &gsframe);
+
+private:
+    double scaling_factor;
+    double clip_limit;
+    cv::Size tiles;
+
+    // Size of the last measured frame, its tiles are sized like OpenCV's
+    cv::Size raw_size;
+    int tile_width = 0;
+    int tile_height = 0;
+
+    // One histogram and lookup table per tile, row by row
+    std::vector<std::array<int, 256>> histograms;
+    std::vector<std::array<unsigned char, 256>> tables;
+
+    // Gray values of the sampled pixels inside the frame, and where they came from
+    cv::Mat samples;
+    std::vector<int> sample_columns;
+
+    // The same samples with their raw channels, and which of them are dark, for dark_bound()
+    cv::Mat raw_samples;
+    cv::Mat dark_mask;
+
+    // Interpolation between the tables, per column of the image being enhanced
+    std::vector<int> first_table;
+    std::vector<int> second_table;
+    std::vector<float> second_weight;
+
+    // One gray row of the small frame, for color cameras
+    std::vector<unsigned char> gray_row;
+
+    // Outputs handed to the other stages
+    std::vector<cv::Mat> frame_pool;
+    std::vector<cv::Mat> gsframe_pool;
+
+    int sample_stride() const;
+    cv::Size padded_size(cv::Size size) const;
+    int dark_limit(cv::Size size, int stride) const;
+    void build_tables(const std::vector<int> &row_counts, const std::vector<int> &column_counts);
+    void prepare_columns(int columns, double spacing, double offset);
+    void apply_row(const unsigned char *gray, unsigned char *out, int columns, float y, size_t *dark);
+};
+
+#endif // FRAME_PREPROCESSOR_H_
@@ -0,0 +1,48 @@
+#include <sys/syslog.h>
+#include <syslog.h>
+
+#include <cstdlib>
+
+#include "image_context.hpp"
+
+std::atomic<long> image_context::conversion_count = 0;
+
+image_context::image_context(const cv::Mat &image) : image(image)
+{
+    if (image.depth() != CV_8U || (image.channels() != 1 && image.channels() != 3))
+    {
+        syslog(LOG_ERR, "Unsupported image type, must be 8bit gray or RGB image.");
+        exit(1);
+    }
+}
+
+const cv::Mat &image_context::mat() const
+{
+    return image;
+}
+
+int image_context::channels() const
+{
+    return image.channels();
+}
+
+const dlib::matrix<dlib::rgb_pixel> &image_context::rgb()
+{
+    if (!converted)
+    {
+        if (image.channels() == 1)
+            dlib::assign_image(rgb_image, dlib::cv_image<unsigned char>(image));
+        else
+            dlib::assign_image(rgb_image, dlib::cv_image<dlib::bgr_pixel>(image));
+
+        converted = true;
+        conversion_count++;
+    }
+
+    return rgb_image;
+}
+
+long image_context::conversions()
+{
+    return conversion_count;
+}
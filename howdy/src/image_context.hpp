@@ -0,0 +1,55 @@
+#ifndef IMAGE_CONTEXT_H_
+#define IMAGE_CONTEXT_H_
+
+#include <atomic>
+
+#include <opencv2/core.hpp>
+
+#include <dlib/opencv.h>
+#include <dlib/matrix.h>
+#include <dlib/pixel.h>
+
+/*
+One frame on its way through detection, landmarking and encoding.
+
+The models read gray and BGR frames in place. Only models that need a
+dlib RGB image, like the CNN detector, ask for one, and the frame is
+converted the first time that happens and never again. Pass the context by
+reference to every model that works on the same frame.
+*/
+class image_context
+{
+public:
+    /*
+    Wraps an 8 bit gray or BGR image, the pixels are not copied
+    */
+    explicit image_context(const cv::Mat &image);
+
+    image_context(const image_context &) = delete;
+    image_context &operator=(const image_context &) = delete;
+
+    const cv::Mat &mat() const;
+
+    int channels() const;
+
+    /*
+    The frame as a dlib RGB image, converted on the first call
+    */
+    const dlib::matrix<dlib::rgb_pixel> &rgb();
+
+    /*
+    Number of full frame conversions made by all contexts so far, for
+    diagnostics and benchmarks
+    */
+    static long conversions();
+
+private:
+    cv::Mat image;
+
+    bool converted = false;
+    dlib::matrix<dlib::rgb_pixel> rgb_image;
+
+    static std::atomic<long> conversion_count;
+};
+
+#endif // IMAGE_CONTEXT_H_
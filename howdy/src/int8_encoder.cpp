@@ -0,0 +1,612 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INT8_X86
+#endif
+
+#include "int8_encoder.hpp"
+#include "int8_encoder_kernels.hpp"
+#include "model_store.hpp"
+
+namespace
+{
+    // Residual blocks from the input to the output, the ones that halve the
+    // frame also add a pooled copy of their input instead of the input itself
+    struct stage
+    {
+        int filters;
+        bool down;
+    };
+
+    const stage STAGES[] = {
+        {32, false}, {32, false}, {32, false},
+        {64, true}, {64, false}, {64, false}, {64, false},
+        {128, true}, {128, false}, {128, false},
+        {256, true}, {256, false}, {256, false},
+        {256, true}};
+
+    const int FIRST_FILTERS = 32;
+    const int FIRST_SIZE = 7;
+
+    // Means dlib's input_rgb_image subtracts, before dividing by 256
+    const float MEAN_RED = 122.782f;
+    const float MEAN_GREEN = 117.001f;
+    const float MEAN_BLUE = 104.298f;
+
+    // Largest quantized input, so two products of a pair fit in 16 bits
+    const int INPUT_MAX = 127;
+    const int WEIGHT_MAX = 127;
+
+    // Share of the input values that has to fit in the calibrated range,
+    // the few above it are clipped
+    const double CALIBRATION_PERCENTILE = 0.9999;
+
+    const char CALIBRATION_MAGIC[8] = {'H', 'O', 'W', 'D', 'Y', 'Q', '8', '\0'};
+    const uint32_t CALIBRATION_VERSION = 1;
+
+#ifdef INT8_X86
+    /*The four sums of four accumulators, in that order*/
+    __attribute__((target("avx2"))) inline __m128i sum_lanes(__m256i a, __m256i b, __m256i c, __m256i d)
+    {
+        __m256i sums = _mm256_hadd_epi32(_mm256_hadd_epi32(a, b), _mm256_hadd_epi32(c, d));
+        return _mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    }
+#endif
+}
+
+namespace int8_kernels
+{
+    void dot_scalar(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out)
+    {
+        for (int f = 0; f < filters; f++)
+        {
+            const int8_t *w = weights + size_t(f) * length;
+            int32_t sum = 0;
+            for (int k = 0; k < length; k++)
+                sum += int32_t(column[k]) * w[k];
+            out[f] = sum;
+        }
+    }
+
+#ifdef INT8_X86
+    __attribute__((target("avx2"))) void dot_avx2(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out)
+    {
+        // Inputs are at most 127, so the pairs maddubs adds up never saturate
+        const __m256i ones = _mm256_set1_epi16(1);
+
+        for (int f = 0; f < filters; f += 4)
+        {
+            const int8_t *w = weights + size_t(f) * length;
+            __m256i acc0 = _mm256_setzero_si256();
+            __m256i acc1 = _mm256_setzero_si256();
+            __m256i acc2 = _mm256_setzero_si256();
+            __m256i acc3 = _mm256_setzero_si256();
+
+            for (int k = 0; k < length; k += 32)
+            {
+                __m256i in = _mm256_loadu_si256((const __m256i *)(column + k));
+                __m256i w0 = _mm256_loadu_si256((const __m256i *)(w + k));
+                __m256i w1 = _mm256_loadu_si256((const __m256i *)(w + length + k));
+                __m256i w2 = _mm256_loadu_si256((const __m256i *)(w + 2 * length + k));
+                __m256i w3 = _mm256_loadu_si256((const __m256i *)(w + 3 * length + k));
+                acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_maddubs_epi16(in, w0), ones));
+                acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_maddubs_epi16(in, w1), ones));
+                acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_maddubs_epi16(in, w2), ones));
+                acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_maddubs_epi16(in, w3), ones));
+            }
+
+            _mm_storeu_si128((__m128i *)(out + f), sum_lanes(acc0, acc1, acc2, acc3));
+        }
+    }
+
+    // VNNI does the multiply and both additions in one instruction
+    __attribute__((target("avx512vnni,avx512vl,avx2"))) void dot_avx512_vnni(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out)
+    {
+        for (int f = 0; f < filters; f += 4)
+        {
+            const int8_t *w = weights + size_t(f) * length;
+            __m256i acc0 = _mm256_setzero_si256();
+            __m256i acc1 = _mm256_setzero_si256();
+            __m256i acc2 = _mm256_setzero_si256();
+            __m256i acc3 = _mm256_setzero_si256();
+
+            for (int k = 0; k < length; k += 32)
+            {
+                __m256i in = _mm256_loadu_si256((const __m256i *)(column + k));
+                acc0 = _mm256_dpbusd_epi32(acc0, in, _mm256_loadu_si256((const __m256i *)(w + k)));
+                acc1 = _mm256_dpbusd_epi32(acc1, in, _mm256_loadu_si256((const __m256i *)(w + length + k)));
+                acc2 = _mm256_dpbusd_epi32(acc2, in, _mm256_loadu_si256((const __m256i *)(w + 2 * length + k)));
+                acc3 = _mm256_dpbusd_epi32(acc3, in, _mm256_loadu_si256((const __m256i *)(w + 3 * length + k)));
+            }
+
+            _mm_storeu_si128((__m128i *)(out + f), sum_lanes(acc0, acc1, acc2, acc3));
+        }
+    }
+
+    // The same instruction on laptop chips without AVX-512
+    __attribute__((target("avxvnni,avx2"))) void dot_avx_vnni(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out)
+    {
+        for (int f = 0; f < filters; f += 4)
+        {
+            const int8_t *w = weights + size_t(f) * length;
+            __m256i acc0 = _mm256_setzero_si256();
+            __m256i acc1 = _mm256_setzero_si256();
+            __m256i acc2 = _mm256_setzero_si256();
+            __m256i acc3 = _mm256_setzero_si256();
+
+            for (int k = 0; k < length; k += 32)
+            {
+                __m256i in = _mm256_loadu_si256((const __m256i *)(column + k));
+                acc0 = _mm256_dpbusd_avx_epi32(acc0, in, _mm256_loadu_si256((const __m256i *)(w + k)));
+                acc1 = _mm256_dpbusd_avx_epi32(acc1, in, _mm256_loadu_si256((const __m256i *)(w + length + k)));
+                acc2 = _mm256_dpbusd_avx_epi32(acc2, in, _mm256_loadu_si256((const __m256i *)(w + 2 * length + k)));
+                acc3 = _mm256_dpbusd_avx_epi32(acc3, in, _mm256_loadu_si256((const __m256i *)(w + 3 * length + k)));
+            }
+
+            _mm_storeu_si128((__m128i *)(out + f), sum_lanes(acc0, acc1, acc2, acc3));
+        }
+    }
+#endif
+
+    std::vector<kernel> supported()
+    {
+        std::vector<kernel> kernels{{dot_scalar, "scalar"}};
+#ifdef INT8_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            kernels.push_back({dot_avx2, "avx2"});
+        if (__builtin_cpu_supports("avxvnni"))
+            kernels.push_back({dot_avx_vnni, "avx-vnni"});
+        if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl"))
+            kernels.push_back({dot_avx512_vnni, "avx512-vnni"});
+#endif
+        return kernels;
+    }
+}
+
+namespace
+{
+    // Picked once per process, the CPU doesn't change under us
+    const int8_kernels::kernel &selected()
+    {
+        static const int8_kernels::kernel chosen = int8_kernels::supported().back();
+        return chosen;
+    }
+
+    int output_side(int input, int size, int stride, int padding)
+    {
+        return (input + 2 * padding - size) / stride + 1;
+    }
+
+    void relu(std::vector<float> &values)
+    {
+        for (float &value : values)
+            value = std::max(value, 0.0f);
+    }
+}
+
+struct int8_encoder::workspace
+{
+    activation x;
+    activation y;
+    activation inner;
+    activation outer;
+    activation pooled;
+    activation sum;
+
+    std::vector<uint8_t> levels;
+    std::vector<uint8_t> column;
+    std::vector<int32_t> sums;
+    std::vector<float> factors;
+    std::vector<float> features;
+};
+
+void int8_encoder::activation::resize(int new_channels, int new_rows, int new_cols)
+{
+    channels = new_channels;
+    rows = new_rows;
+    cols = new_cols;
+    values.assign(size_t(channels) * rows * cols, 0);
+}
+
+bool int8_encoder::set_parameters(const std::vector<std::vector<float>> &convolutions, const std::vector<float> &fc)
+{
+    // The shapes follow from the layout of the network, the parameters only fill them
+    std::vector<convolution> shapes;
+    auto add_shape = [&shapes](int filters, int channels, int size, int stride, int padding)
+    {
+        convolution &layer = shapes.emplace_back();
+        layer.filters = filters;
+        layer.channels = channels;
+        layer.size = size;
+        layer.stride = stride;
+        layer.padding = padding;
+    };
+
+    add_shape(FIRST_FILTERS, 3, FIRST_SIZE, 2, 0);
+    int channels = FIRST_FILTERS;
+    for (const stage &s : STAGES)
+    {
+        // dlib only pads convolutions that keep the size of the frame
+        add_shape(s.filters, channels, 3, s.down ? 2 : 1, s.down ? 0 : 1);
+        add_shape(s.filters, s.filters, 3, 1, 1);
+        channels = s.filters;
+    }
+
+    if (convolutions.size() != shapes.size() || fc.size() != size_t(channels) * DESCRIPTOR_SIZE)
+        return false;
+
+    fingerprint = 0;
+    for (size_t i = 0; i < shapes.size(); i++)
+    {
+        convolution &layer = shapes[i];
+        size_t per_filter = size_t(layer.channels) * layer.size * layer.size;
+        const std::vector<float> &params = convolutions[i];
+        if (params.size() != (per_filter + 1) * layer.filters)
+            return false;
+
+        layer.weights.assign(params.begin(), params.begin() + per_filter * layer.filters);
+        layer.bias.assign(params.begin() + per_filter * layer.filters, params.end());
+        for (float value : params)
+            fingerprint += std::fabs(value);
+
+        // The first layer sees the image itself, it is never quantized
+        if (i == 0)
+            continue;
+
+        // Symmetric scales per filter, zero stays exactly zero
+        layer.row_length = int((per_filter + 31) / 32 * 32);
+        layer.quantized.assign(size_t(layer.row_length) * layer.filters, 0);
+        layer.weight_scale.resize(layer.filters);
+        for (int f = 0; f < layer.filters; f++)
+        {
+            const float *w = layer.weights.data() + f * per_filter;
+            float largest = 0;
+            for (size_t k = 0; k < per_filter; k++)
+                largest = std::max(largest, std::fabs(w[k]));
+
+            float scale = largest > 0 ? largest / WEIGHT_MAX : 1;
+            layer.weight_scale[f] = scale;
+            for (size_t k = 0; k < per_filter; k++)
+                layer.quantized[size_t(f) * layer.row_length + k] = int8_t(std::lrint(w[k] / scale));
+        }
+    }
+
+    for (float value : fc)
+        fingerprint += std::fabs(value);
+
+    layers = std::move(shapes);
+    fc_weights = fc;
+    return true;
+}
+
+void int8_encoder::calibrate(const std::vector<const unsigned char *> &chips)
+{
+    std::vector<float> largest(layers.size(), 0);
+    std::vector<float> ranges;
+    std::vector<float> descriptor(DESCRIPTOR_SIZE);
+
+    for (const unsigned char *chip : chips)
+    {
+        forward(chip, descriptor.data(), false, &ranges);
+        for (size_t i = 0; i < layers.size(); i++)
+            largest[i] = std::max(largest[i], ranges[i]);
+    }
+
+    for (size_t i = 1; i < layers.size(); i++)
+        layers[i].input_scale = largest[i] > 0 ? largest[i] / INPUT_MAX : 1;
+}
+
+bool int8_encoder::load_calibration(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    char magic[sizeof(CALIBRATION_MAGIC)];
+    uint32_t version, count;
+    double made_for;
+    file.read(magic, sizeof(magic));
+    file.read((char *)&version, sizeof(version));
+    file.read((char *)&count, sizeof(count));
+    file.read((char *)&made_for, sizeof(made_for));
+    if (!file || std::memcmp(magic, CALIBRATION_MAGIC, sizeof(magic)) != 0 ||
+        version != CALIBRATION_VERSION || count != layers.size())
+        return false;
+
+    // Float sums can come out slightly different between builds
+    if (std::fabs(made_for - fingerprint) > 1e-6 * fingerprint)
+        return false;
+
+    std::vector<float> scales(count);
+    file.read((char *)scales.data(), count * sizeof(float));
+    if (!file)
+        return false;
+
+    for (size_t i = 1; i < layers.size(); i++)
+    {
+        if (!(scales[i] > 0))
+            return false;
+    }
+
+    for (size_t i = 0; i < layers.size(); i++)
+        layers[i].input_scale = scales[i];
+    return true;
+}
+
+bool int8_encoder::save_calibration(const std::string &path) const
+{
+    if (!calibrated())
+        return false;
+
+    uint32_t count = layers.size();
+    std::vector<float> scales;
+    for (const convolution &layer : layers)
+        scales.push_back(layer.input_scale);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(CALIBRATION_MAGIC, sizeof(CALIBRATION_MAGIC));
+    file.write((const char *)&CALIBRATION_VERSION, sizeof(CALIBRATION_VERSION));
+    file.write((const char *)&count, sizeof(count));
+    file.write((const char *)&fingerprint, sizeof(fingerprint));
+    file.write((const char *)scales.data(), count * sizeof(float));
+    return bool(file);
+}
+
+bool int8_encoder::calibrated() const
+{
+    if (layers.empty())
+        return false;
+
+    for (size_t i = 1; i < layers.size(); i++)
+    {
+        if (layers[i].input_scale <= 0)
+            return false;
+    }
+    return true;
+}
+
+void int8_encoder::encode(const unsigned char *chip, float *descriptor, bool quantized) const
+{
+    forward(chip, descriptor, quantized && calibrated(), nullptr);
+}
+
+const char *int8_encoder::instruction_set()
+{
+    return selected().name;
+}
+
+void int8_encoder::forward(const unsigned char *chip, float *descriptor, bool quantized, std::vector<float> *ranges) const
+{
+    if (ranges)
+        ranges->assign(layers.size(), 0);
+
+    // Every thread encoding chips gets its own buffers, sized by the first chip
+    thread_local workspace buffers;
+    activation &x = buffers.x;
+    activation &y = buffers.y;
+    activation &inner = buffers.inner;
+    activation &outer = buffers.outer;
+    activation &pooled = buffers.pooled;
+    activation &sum = buffers.sum;
+
+    // Same input scaling as dlib, one plane per color
+    x.resize(3, CHIP_SIZE, CHIP_SIZE);
+    const float means[3] = {MEAN_RED, MEAN_GREEN, MEAN_BLUE};
+    for (int c = 0; c < 3; c++)
+    {
+        float *plane = x.plane(c);
+        for (int i = 0; i < CHIP_SIZE * CHIP_SIZE; i++)
+            plane[i] = (chip[i * 3 + c] - means[c]) / 256;
+    }
+
+    convolve(layers[0], x, y, false, buffers);
+    relu(y.values);
+
+    // 3x3 max pooling with a stride of 2, without padding
+    x.resize(y.channels, output_side(y.rows, 3, 2, 0), output_side(y.cols, 3, 2, 0));
+    for (int c = 0; c < x.channels; c++)
+    {
+        const float *in = y.plane(c);
+        float *out = x.plane(c);
+        for (int r = 0; r < x.rows; r++)
+        {
+            for (int col = 0; col < x.cols; col++)
+            {
+                float largest = in[(r * 2) * y.cols + col * 2];
+                for (int i = 0; i < 3; i++)
+                    for (int j = 0; j < 3; j++)
+                        largest = std::max(largest, in[(r * 2 + i) * y.cols + col * 2 + j]);
+                out[r * x.cols + col] = largest;
+            }
+        }
+    }
+
+    // Records the range of the input of a layer, for calibration
+    auto record = [&](size_t layer, const activation &input)
+    {
+        if (!ranges)
+            return;
+
+        std::vector<float> values = input.values;
+        size_t nth = std::min(values.size() - 1, size_t(values.size() * CALIBRATION_PERCENTILE));
+        std::nth_element(values.begin(), values.begin() + nth, values.end());
+        (*ranges)[layer] = values[nth];
+    };
+
+    size_t next = 1;
+    for (const stage &s : STAGES)
+    {
+        const convolution &first = layers[next];
+        const convolution &second = layers[next + 1];
+
+        record(next, x);
+        convolve(first, x, inner, quantized, buffers);
+        relu(inner.values);
+        record(next + 1, inner);
+        convolve(second, inner, outer, quantized, buffers);
+        next += 2;
+
+        // 2x2 average pooling of the input for blocks that halve the frame
+        const activation *shortcut = &x;
+        if (s.down)
+        {
+            pooled.resize(x.channels, output_side(x.rows, 2, 2, 0), output_side(x.cols, 2, 2, 0));
+            for (int c = 0; c < x.channels; c++)
+            {
+                const float *in = x.plane(c);
+                float *out = pooled.plane(c);
+                for (int r = 0; r < pooled.rows; r++)
+                {
+                    for (int col = 0; col < pooled.cols; col++)
+                    {
+                        const float *corner = in + (r * 2) * x.cols + col * 2;
+                        out[r * pooled.cols + col] = (corner[0] + corner[1] + corner[x.cols] + corner[x.cols + 1]) / 4;
+                    }
+                }
+            }
+            shortcut = &pooled;
+        }
+
+        // Like dlib's add_prev, the sum is as large as the larger of the two
+        // in every dimension, with the missing parts of the other taken as 0
+        sum.resize(std::max(outer.channels, shortcut->channels), std::max(outer.rows, shortcut->rows), std::max(outer.cols, shortcut->cols));
+        const activation *parts[] = {&outer, shortcut};
+        for (const activation *part : parts)
+        {
+            for (int c = 0; c < part->channels; c++)
+            {
+                const float *in = part->plane(c);
+                float *out = sum.plane(c);
+                for (int r = 0; r < part->rows; r++)
+                    for (int col = 0; col < part->cols; col++)
+                        out[r * sum.cols + col] += in[r * part->cols + col];
+            }
+        }
+        relu(sum.values);
+        std::swap(x, sum);
+    }
+
+    // Average of every channel over the whole frame, then the fully connected layer
+    std::vector<float> &features = buffers.features;
+    features.resize(x.channels);
+    for (int c = 0; c < x.channels; c++)
+    {
+        const float *in = x.plane(c);
+        double total = 0;
+        for (int i = 0; i < x.rows * x.cols; i++)
+            total += in[i];
+        features[c] = total / (x.rows * x.cols);
+    }
+
+    std::fill(descriptor, descriptor + DESCRIPTOR_SIZE, 0.0f);
+    for (int c = 0; c < x.channels; c++)
+    {
+        const float *w = fc_weights.data() + size_t(c) * DESCRIPTOR_SIZE;
+        for (int o = 0; o < DESCRIPTOR_SIZE; o++)
+            descriptor[o] += features[c] * w[o];
+    }
+}
+
+void int8_encoder::convolve(const convolution &layer, const activation &input, activation &output, bool quantized, workspace &buffers) const
+{
+    int rows = output_side(input.rows, layer.size, layer.stride, layer.padding);
+    int cols = output_side(input.cols, layer.size, layer.stride, layer.padding);
+    output.resize(layer.filters, rows, cols);
+
+    if (!quantized || layer.quantized.empty())
+    {
+        // Straight float convolution, every weight is swept over the whole output plane
+        size_t per_filter = size_t(layer.channels) * layer.size * layer.size;
+        for (int f = 0; f < layer.filters; f++)
+        {
+            float *out = output.plane(f);
+            std::fill(out, out + rows * cols, layer.bias[f]);
+
+            for (int c = 0; c < layer.channels; c++)
+            {
+                const float *in = input.plane(c);
+                for (int i = 0; i < layer.size; i++)
+                {
+                    for (int j = 0; j < layer.size; j++)
+                    {
+                        float w = layer.weights[f * per_filter + (c * layer.size + i) * layer.size + j];
+
+                        // Only the outputs whose input pixel is inside the frame
+                        int r_begin = std::max(0, (layer.padding - i + layer.stride - 1) / layer.stride);
+                        int r_end = std::min(rows, (input.rows + layer.padding - i + layer.stride - 1) / layer.stride);
+                        int c_begin = std::max(0, (layer.padding - j + layer.stride - 1) / layer.stride);
+                        int c_end = std::min(cols, (input.cols + layer.padding - j + layer.stride - 1) / layer.stride);
+
+                        for (int r = r_begin; r < r_end; r++)
+                        {
+                            const float *line = in + (r * layer.stride + i - layer.padding) * input.cols + j - layer.padding;
+                            float *target = out + r * cols;
+                            if (layer.stride == 1)
+                            {
+                                for (int col = c_begin; col < c_end; col++)
+                                    target[col] += w * line[col];
+                            }
+                            else
+                            {
+                                for (int col = c_begin; col < c_end; col++)
+                                    target[col] += w * line[col * layer.stride];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+    // Quantize the input once, the padding around it is exactly 0
+    float step = layer.input_scale;
+    std::vector<uint8_t> &levels = buffers.levels;
+    levels.resize(input.values.size());
+    for (size_t i = 0; i < levels.size(); i++)
+        levels[i] = uint8_t(std::min(float(INPUT_MAX), std::nearbyint(std::max(input.values[i], 0.0f) / step)));
+
+    // One column of inputs per output pixel, each dotted with every filter
+    // The padding at the end of a column stays 0, only the first values are written
+    std::vector<uint8_t> &column = buffers.column;
+    column.assign(layer.row_length, 0);
+    std::vector<int32_t> &sums = buffers.sums;
+    sums.resize(layer.filters);
+    std::vector<float> &factors = buffers.factors;
+    factors.resize(layer.filters);
+    for (int f = 0; f < layer.filters; f++)
+        factors[f] = step * layer.weight_scale[f];
+
+    int8_kernels::dot_function dot = selected().dot;
+    for (int r = 0; r < rows; r++)
+    {
+        for (int col = 0; col < cols; col++)
+        {
+            uint8_t *next = column.data();
+            for (int c = 0; c < layer.channels; c++)
+            {
+                const uint8_t *in = levels.data() + size_t(c) * input.rows * input.cols;
+                for (int i = 0; i < layer.size; i++)
+                {
+                    int y = r * layer.stride + i - layer.padding;
+                    for (int j = 0; j < layer.size; j++)
+                    {
+                        int x = col * layer.stride + j - layer.padding;
+                        bool inside = y >= 0 && y < input.rows && x >= 0 && x < input.cols;
+                        *next++ = inside ? in[y * input.cols + x] : 0;
+                    }
+                }
+            }
+
+            dot(column.data(), layer.quantized.data(), layer.filters, layer.row_length, sums.data());
+
+            for (int f = 0; f < layer.filters; f++)
+                output.plane(f)[r * cols + col] = sums[f] * factors[f] + layer.bias[f];
+        }
+    }
+}
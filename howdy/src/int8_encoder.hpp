@@ -0,0 +1,114 @@
+#ifndef INT8_ENCODER_H_
+#define INT8_ENCODER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Runs the network of face_recognition_model_v1 with 8 bit integer
+convolutions, for CPUs that are too slow for the float network.
+
+It takes the parameters of the network with the affine layers folded into
+the convolutions. Filters are quantized with one scale per output channel
+when the parameters are set. The inputs of the convolutions all come out of
+a ReLU, so they are quantized to 0..127 with one scale per layer, found by
+calibrate() on sample chips and kept in a small file next to the model.
+
+The first convolution, which sees the image itself, the pooling layers,
+the residual sums and the final fully connected layer stay in floating
+point. Together they are a small part of the work.
+*/
+class int8_encoder
+{
+public:
+    // Side of the square RGB face chips the network takes
+    static const int CHIP_SIZE = 150;
+
+    /*
+    Parameters of the fused network the way dlib lays them out: filters
+    then biases of every convolution from the input to the output, and the
+    weights of the fully connected layer. Returns false if they don't fit
+    the network.
+    */
+    bool set_parameters(const std::vector<std::vector<float>> &convolutions, const std::vector<float> &fc);
+
+    /*
+    Finds the range of the inputs of every quantized convolution by running
+    the float network on sample chips, CHIP_SIZE * CHIP_SIZE RGB pixels each
+    */
+    void calibrate(const std::vector<const unsigned char *> &chips);
+
+    /*
+    The calibration file also records which parameters it was made for, a
+    file for a different model is not loaded
+    */
+    bool load_calibration(const std::string &path);
+    bool save_calibration(const std::string &path) const;
+
+    bool calibrated() const;
+
+    /*
+    Writes the descriptor of a chip, DESCRIPTOR_SIZE floats. Runs the whole
+    network in floating point if quantized is false, which is what the int8
+    results are compared to. Safe to call from several threads at once.
+    */
+    void encode(const unsigned char *chip, float *descriptor, bool quantized = true) const;
+
+    /*
+    Name of the integer kernel picked for this CPU
+    */
+    static const char *instruction_set();
+
+private:
+    struct convolution
+    {
+        int filters = 0;
+        int channels = 0;
+        int size = 0;
+        int stride = 1;
+        int padding = 0;
+
+        std::vector<float> weights;
+        std::vector<float> bias;
+
+        // Filters as 8 bit integers, each padded with zeros to row_length values
+        std::vector<int8_t> quantized;
+        std::vector<float> weight_scale;
+        int row_length = 0;
+
+        // Value of one step of the quantized input, 0 until calibrated
+        float input_scale = 0;
+    };
+
+    struct activation
+    {
+        int channels = 0;
+        int rows = 0;
+        int cols = 0;
+        std::vector<float> values;
+
+        void resize(int channels, int rows, int cols);
+        float *plane(int channel) { return values.data() + size_t(channel) * rows * cols; }
+        const float *plane(int channel) const { return values.data() + size_t(channel) * rows * cols; }
+    };
+
+    // Buffers of one thread, they keep their capacity from chip to chip
+    struct workspace;
+
+    std::vector<convolution> layers;
+    // Inputs x outputs, the fully connected layer has no bias
+    std::vector<float> fc_weights;
+    // Sum of the magnitudes of all parameters, ties a calibration to them
+    double fingerprint = 0;
+
+    /*
+    Runs the network. If ranges is given, the range of the input of every
+    convolution is written to it, for calibration.
+    */
+    void forward(const unsigned char *chip, float *descriptor, bool quantized, std::vector<float> *ranges) const;
+
+    void convolve(const convolution &layer, const activation &input, activation &output, bool quantized, workspace &buffers) const;
+};
+
+#endif // INT8_ENCODER_H_
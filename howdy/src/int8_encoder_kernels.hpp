@@ -0,0 +1,42 @@
+#ifndef INT8_ENCODER_KERNELS_H_
+#define INT8_ENCODER_KERNELS_H_
+
+#include <cstdint>
+#include <vector>
+
+/*
+The integer dot products behind int8_encoder, one per instruction set.
+
+Only int8_encoder and the int8 bench use these, the bench to check every
+kernel the CPU can run against dot_scalar.
+*/
+namespace int8_kernels
+{
+    /*
+    Dot products of one column of quantized inputs with every filter of a
+    layer. length is a multiple of 32 and filters a multiple of 4. Inputs
+    are at most 127 and weights between -127 and 127.
+    */
+    using dot_function = void (*)(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out);
+
+    struct kernel
+    {
+        dot_function dot;
+        const char *name;
+    };
+
+    void dot_scalar(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out);
+
+#if defined(__x86_64__) || defined(__i386__)
+    void dot_avx2(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out);
+    void dot_avx_vnni(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out);
+    void dot_avx512_vnni(const uint8_t *column, const int8_t *weights, int filters, int length, int32_t *out);
+#endif
+
+    /*
+    The kernels this CPU can run, from the slowest to the fastest
+    */
+    std::vector<kernel> supported();
+}
+
+#endif // INT8_ENCODER_KERNELS_H_
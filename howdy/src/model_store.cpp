@@ -0,0 +1,326 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "model_store.hpp"
+
+#include "utils/json.hpp"
+
+using json = nlohmann::json;
+
+namespace
+{
+    // Identifies a howdy model file, followed by the format version
+    const char MODEL_MAGIC[8] = {'H', 'O', 'W', 'D', 'Y', 'M', 'D', 'L'};
+    const uint32_t MODEL_VERSION = 1;
+
+    // Alignment of the descriptor array, a full cache line
+    const size_t DESCRIPTOR_ALIGNMENT = 64;
+
+    struct model_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t dimensions;
+        uint32_t model_count;
+        uint32_t descriptor_count;
+        uint64_t entries_offset;
+        uint64_t descriptors_offset;
+        char reserved[24];
+    };
+
+    struct model_entry
+    {
+        int64_t time;
+        int32_t id;
+        uint32_t first_descriptor;
+        uint32_t descriptor_count;
+        // Zero terminated
+        char label[44];
+    };
+
+    static_assert(sizeof(model_header) == 64, "Model header must stay 64 bytes");
+    static_assert(sizeof(model_entry) == 64, "Model entry must stay 64 bytes");
+
+    const model_header &header(const char *base)
+    {
+        return *reinterpret_cast<const model_header *>(base);
+    }
+
+    const model_entry &entry(const char *base, size_t model)
+    {
+        return reinterpret_cast<const model_entry *>(base + header(base).entries_offset)[model];
+    }
+
+    size_t align(size_t offset)
+    {
+        return (offset + DESCRIPTOR_ALIGNMENT - 1) / DESCRIPTOR_ALIGNMENT * DESCRIPTOR_ALIGNMENT;
+    }
+
+    /*Lay the models out in the binary format*/
+    std::string serialize(const std::vector<face_model> &models)
+    {
+        uint32_t descriptor_count = 0;
+        for (auto &model : models)
+            descriptor_count += model.data.size();
+
+        model_header head = {};
+        std::memcpy(head.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+        head.version = MODEL_VERSION;
+        head.dimensions = DESCRIPTOR_SIZE;
+        head.model_count = models.size();
+        head.descriptor_count = descriptor_count;
+        head.entries_offset = sizeof(model_header);
+        head.descriptors_offset = align(head.entries_offset + models.size() * sizeof(model_entry));
+
+        std::string out(head.descriptors_offset + size_t(descriptor_count) * DESCRIPTOR_SIZE * sizeof(float), '\0');
+        std::memcpy(out.data(), &head, sizeof(head));
+
+        uint32_t next = 0;
+        for (size_t i = 0; i < models.size(); i++)
+        {
+            const face_model &model = models[i];
+
+            model_entry ent = {};
+            ent.time = model.time;
+            ent.id = model.id;
+            ent.first_descriptor = next;
+            ent.descriptor_count = model.data.size();
+            // Longer labels are cut off, the cli limits them to 24 characters anyway
+            std::strncpy(ent.label, model.label.c_str(), sizeof(ent.label) - 1);
+            std::memcpy(out.data() + head.entries_offset + i * sizeof(model_entry), &ent, sizeof(ent));
+
+            for (auto &row : model.data)
+            {
+                float *dest = reinterpret_cast<float *>(out.data() + head.descriptors_offset) + size_t(next) * DESCRIPTOR_SIZE;
+                std::copy_n(row.begin(), std::min<size_t>(row.size(), DESCRIPTOR_SIZE), dest);
+                next++;
+            }
+        }
+
+        return out;
+    }
+
+    /*Read a model file in the old JSON format*/
+    bool parse_json(const std::string &path, std::vector<face_model> &models)
+    {
+        try
+        {
+            std::ifstream f(path);
+            json encodings = json::parse(f);
+
+            for (auto &enc : encodings)
+            {
+                face_model model;
+                model.id = enc["id"].get<int>();
+                model.time = enc["time"].get<int64_t>();
+                model.label = enc["label"].get<std::string>();
+                for (auto &row : enc["data"])
+                    model.data.push_back(row.get<std::vector<float>>());
+                models.push_back(model);
+            }
+        }
+        catch (std::exception &e)
+        {
+            return false;
+        }
+
+        return true;
+    }
+}
+
+model_store::~model_store()
+{
+    close();
+}
+
+void model_store::close()
+{
+    if (mapped)
+        munmap(const_cast<char *>(base), length);
+    else
+        std::free(const_cast<char *>(base));
+
+    base = nullptr;
+    length = 0;
+    mapped = false;
+}
+
+bool model_store::open(const std::string &path)
+{
+    close();
+
+    if (map(path))
+        return true;
+
+    // Not a binary model file, try the JSON format of older versions
+    std::vector<face_model> models;
+    if (!parse_json(path, models))
+        return false;
+
+    // Convert it for good if we're allowed to, and use the new file
+    if (access(path.c_str(), W_OK) == 0 && save(path, models) && map(path))
+        return true;
+
+    // Otherwise keep the converted data in memory for this run
+    std::string data = serialize(models);
+    char *buffer = static_cast<char *>(std::aligned_alloc(DESCRIPTOR_ALIGNMENT, align(data.size())));
+    if (!buffer)
+        return false;
+
+    std::memcpy(buffer, data.data(), data.size());
+    base = buffer;
+    length = data.size();
+    mapped = false;
+
+    return validate();
+}
+
+bool model_store::map(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(model_header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    base = static_cast<const char *>(addr);
+    length = st.st_size;
+    mapped = true;
+
+    if (!validate())
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool model_store::validate()
+{
+    const model_header &head = header(base);
+
+    if (std::memcmp(head.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0)
+        return false;
+
+    if (head.version != MODEL_VERSION || head.dimensions != DESCRIPTOR_SIZE)
+        return false;
+
+    if (head.entries_offset + uint64_t(head.model_count) * sizeof(model_entry) > length)
+        return false;
+
+    if (head.descriptors_offset % DESCRIPTOR_ALIGNMENT != 0 ||
+        head.descriptors_offset + uint64_t(head.descriptor_count) * DESCRIPTOR_SIZE * sizeof(float) > length)
+        return false;
+
+    // Every model has to point at descriptors that exist
+    for (size_t i = 0; i < head.model_count; i++)
+    {
+        const model_entry &ent = entry(base, i);
+        if (uint64_t(ent.first_descriptor) + ent.descriptor_count > head.descriptor_count)
+            return false;
+    }
+
+    return true;
+}
+
+size_t model_store::size() const
+{
+    return base ? header(base).model_count : 0;
+}
+
+int model_store::id(size_t model) const
+{
+    return entry(base, model).id;
+}
+
+int64_t model_store::time(size_t model) const
+{
+    return entry(base, model).time;
+}
+
+std::string model_store::label(size_t model) const
+{
+    const model_entry &ent = entry(base, model);
+    return std::string(ent.label, strnlen(ent.label, sizeof(ent.label)));
+}
+
+size_t model_store::descriptor_count() const
+{
+    return base ? header(base).descriptor_count : 0;
+}
+
+const float *model_store::descriptors() const
+{
+    return reinterpret_cast<const float *>(base + header(base).descriptors_offset);
+}
+
+size_t model_store::model_of(size_t descriptor) const
+{
+    for (size_t i = 0; i < size(); i++)
+    {
+        const model_entry &ent = entry(base, i);
+        if (descriptor >= ent.first_descriptor && descriptor < ent.first_descriptor + ent.descriptor_count)
+            return i;
+    }
+
+    return 0;
+}
+
+std::vector<face_model> model_store::models() const
+{
+    std::vector<face_model> result;
+
+    for (size_t i = 0; i < size(); i++)
+    {
+        const model_entry &ent = entry(base, i);
+
+        face_model model;
+        model.id = ent.id;
+        model.time = ent.time;
+        model.label = label(i);
+        for (size_t d = ent.first_descriptor; d < ent.first_descriptor + ent.descriptor_count; d++)
+        {
+            const float *row = descriptors() + d * DESCRIPTOR_SIZE;
+            model.data.emplace_back(row, row + DESCRIPTOR_SIZE);
+        }
+        result.push_back(model);
+    }
+
+    return result;
+}
+
+bool model_store::save(const std::string &path, const std::vector<face_model> &models)
+{
+    std::string data = serialize(models);
+
+    // Write next to the real file and move it in place when complete
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), data.size());
+        if (!out)
+            return false;
+    }
+
+    return rename(temp_path.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,103 @@
+#ifndef MODEL_STORE_H_
+#define MODEL_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Number of values in a face descriptor
+const int DESCRIPTOR_SIZE = 128;
+
+/*
+A face model the way the cli edits it, the metadata and one or more
+descriptors of the face
+*/
+struct face_model
+{
+    int id;
+    int64_t time;
+    std::string label;
+    std::vector<std::vector<float>> data;
+};
+
+/*
+Read access to the face models of a user.
+
+Model files are stored in a versioned binary format: a header, a table with
+the metadata of every model, and the descriptors of all models as one
+contiguous array of 32 bit floats aligned to 64 bytes. The file is mapped into
+memory as it is, so the matcher can work on it without any parsing.
+*/
+class model_store
+{
+public:
+    model_store() = default;
+
+    /*
+    Unmaps the file
+    */
+    ~model_store();
+
+    model_store(const model_store &) = delete;
+    model_store &operator=(const model_store &) = delete;
+
+    /*
+    Opens the model file at the given path. Files still in the old JSON
+    format are converted to the binary format on the way, or only read if
+    the file can't be written.
+
+    Returns false if the file does not exist or can't be read.
+    */
+    bool open(const std::string &path);
+
+    /*
+    Number of models in the file
+    */
+    size_t size() const;
+
+    int id(size_t model) const;
+    int64_t time(size_t model) const;
+    std::string label(size_t model) const;
+
+    /*
+    Number of descriptors of all models together
+    */
+    size_t descriptor_count() const;
+
+    /*
+    All descriptors, DESCRIPTOR_SIZE floats per row
+    */
+    const float *descriptors() const;
+
+    /*
+    The model a descriptor belongs to
+    */
+    size_t model_of(size_t descriptor) const;
+
+    /*
+    A copy of all models, for editing
+    */
+    std::vector<face_model> models() const;
+
+    /*
+    Writes models to path in the binary format. The file is replaced
+    atomically, so readers never see half a file.
+    */
+    static bool save(const std::string &path, const std::vector<face_model> &models);
+
+private:
+    void close();
+
+    bool map(const std::string &path);
+
+    bool validate();
+
+    // Start of the mapped file or of the converted JSON data
+    const char *base = nullptr;
+    size_t length = 0;
+    // True if base points to a mapping, false if it was allocated
+    bool mapped = false;
+};
+
+#endif // MODEL_STORE_H_
@@ -1,40 +1,94 @@
 #include <sys/syslog.h>
 #include <syslog.h>
 
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+#include <dlib/revision.h>
+
 #include "utils.hpp"
 #include "models.hpp"
 
+// Load times are durations, they must not jump with the wall clock
+typedef std::chrono::steady_clock load_clock;
+
 std::vector<rectangle> face_detection_model::operator()(cv::Mat &image, const int upsample_num_times)
 {
-    pyramid_down<2> pyr;
-    std::vector<rectangle> rects;
+    image_context context(image);
+    return (*this)(context, upsample_num_times);
+}
 
-    matrix<rgb_pixel> dimage;
-    convert_image(image, dimage);
+void face_detection_model::upsample(image_context &image, const int upsample_num_times)
+{
+    if (upsample_num_times == 0)
+        return;
 
-    // Upsampling the image will allow us to detect smaller faces but will cause the
-    // program to use more RAM and run longer.
-    unsigned int levels = upsample_num_times;
-    while (levels > 0)
+    // Every level reads from the one before, the frame itself for the first, and
+    // the levels take turns in the two buffers of the workspace
+    pyramid_down<2> pyr;
+    if (image.channels() == 1 && reads_gray())
     {
-        levels--;
-        pyramid_up(dimage, pyr);
+        pyramid_up(cv_image<unsigned char>(image.mat()), gray_levels[0], pyr);
+        for (int level = 1; level < upsample_num_times; level++)
+            pyramid_up(gray_levels[(level - 1) % 2], gray_levels[level % 2], pyr);
     }
+    else
+    {
+        // Upsampling the image will allow us to detect smaller faces but will cause the
+        // program to use more RAM and run longer.
+        pyramid_up(image.rgb(), rgb_levels[0], pyr);
+        for (int level = 1; level < upsample_num_times; level++)
+            pyramid_up(rgb_levels[(level - 1) % 2], rgb_levels[level % 2], pyr);
+    }
+}
 
-    auto dets = detect(dimage);
+std::vector<rectangle> face_detection_model::operator()(image_context &image, const int upsample_num_times)
+{
+    upsample(image, upsample_num_times);
+
+    std::vector<rectangle> dets;
+    int last = (upsample_num_times - 1) % 2;
+    if (image.channels() == 1 && reads_gray())
+    {
+        // Without upsampling the detector works on the frame itself
+        if (upsample_num_times == 0)
+            dets = detect_gray(cv_image<unsigned char>(image.mat()));
+        else
+            dets = detect_gray(gray_levels[last]);
+    }
+    else
+    {
+        dets = detect(upsample_num_times == 0 ? image.rgb() : rgb_levels[last]);
+    }
 
     // Scale the detection locations back to the original image size
     // if the image was upscaled.
+    pyramid_down<2> pyr;
     for (auto &&rect : dets)
-    {
         rect = pyr.rect_down(rect, upsample_num_times);
-        rects.push_back(rect);
-    }
 
-    return rects;
+    return dets;
 }
 
-std::vector<rectangle> face_detection_model::detect(matrix<rgb_pixel> &image)
+std::vector<rectangle> face_detection_model::detect(const matrix<rgb_pixel> &image)
+{
+    return std::vector<rectangle>();
+}
+
+bool face_detection_model::reads_gray() const
+{
+    return false;
+}
+
+std::vector<rectangle> face_detection_model::detect_gray(const cv_image<unsigned char> &image)
+{
+    return std::vector<rectangle>();
+}
+
+std::vector<rectangle> face_detection_model::detect_gray(const matrix<unsigned char> &image)
 {
     return std::vector<rectangle>();
 }
@@ -44,7 +98,7 @@ cnn_face_detection_model_v1::cnn_face_detection_model_v1(const std::string &mode
     deserialize(model_filename) >> net;
 }
 
-std::vector<rectangle> cnn_face_detection_model_v1::detect(matrix<rgb_pixel> &image)
+std::vector<rectangle> cnn_face_detection_model_v1::detect(const matrix<rgb_pixel> &image)
 {
     std::vector<mmod_rect> dets = net(image);
     std::vector<rectangle> rects;
@@ -60,14 +114,363 @@ frontal_face_detector_model::frontal_face_detector_model()
     detector = get_frontal_face_detector();
 }
 
-std::vector<rectangle> frontal_face_detector_model::detect(matrix<rgb_pixel> &image)
+std::vector<rectangle> frontal_face_detector_model::detect(const matrix<rgb_pixel> &image)
 {
     return detector(image);
 }
 
-face_recognition_model_v1::face_recognition_model_v1(const std::string &model_filename)
+bool frontal_face_detector_model::reads_gray() const
+{
+    return true;
+}
+
+std::vector<rectangle> frontal_face_detector_model::detect_gray(const cv_image<unsigned char> &image)
+{
+    return detector(image);
+}
+
+std::vector<rectangle> frontal_face_detector_model::detect_gray(const matrix<unsigned char> &image)
+{
+    return detector(image);
+}
+
+cascade_face_detection_model::cascade_face_detection_model(const std::string &model_filename, int fallback_interval)
+    : cnn(model_filename), fallback_interval(fallback_interval)
+{
+}
+
+std::vector<rectangle> cascade_face_detection_model::operator()(image_context &image, const int upsample_num_times)
+{
+    std::vector<rectangle> faces;
+    for (const rectangle &hit : hog(image, upsample_num_times))
+    {
+        rectangle face;
+        if (confirm(image, hit, face))
+        {
+            faces.push_back(face);
+            confirmed_count++;
+        }
+        else
+        {
+            dropped_count++;
+        }
+    }
+
+    if (!faces.empty())
+    {
+        misses = 0;
+        return faces;
+    }
+
+    if (fallback_interval <= 0 || ++misses < fallback_interval)
+        return faces;
+
+    misses = 0;
+    fallback_count++;
+    return search_full_frame(image, upsample_num_times);
+}
+
+bool cascade_face_detection_model::confirm(image_context &image, const rectangle &hit, rectangle &face)
+{
+    // Half the box of margin on every side, scaled so the face has the size the CNN likes best
+    rectangle area = grow_rect(hit, hit.width() / 2);
+    double scale = CROP_FACE_SIZE / hit.width();
+    chip_details details(area, chip_dims(std::lround(area.height() * scale), std::lround(area.width() * scale)));
+
+    // Only the crop is converted to RGB, parts outside the frame are black
+    matrix<rgb_pixel> crop;
+    if (image.channels() == 1)
+        extract_image_chip(cv_image<unsigned char>(image.mat()), details, crop);
+    else
+        extract_image_chip(cv_image<bgr_pixel>(image.mat()), details, crop);
+
+    double scale_x = double(area.width()) / crop.nc();
+    double scale_y = double(area.height()) / crop.nr();
+
+    double best = MIN_OVERLAP;
+    bool found = false;
+    for (const rectangle &det : cnn.detect(crop))
+    {
+        rectangle mapped(
+            area.left() + std::lround(det.left() * scale_x),
+            area.top() + std::lround(det.top() * scale_y),
+            area.left() + std::lround(det.right() * scale_x),
+            area.top() + std::lround(det.bottom() * scale_y));
+
+        double overlap = box_intersection_over_union(drectangle(mapped), drectangle(hit));
+        if (overlap >= best)
+        {
+            best = overlap;
+            face = mapped;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+std::vector<rectangle> cascade_face_detection_model::search_full_frame(image_context &image, const int upsample_num_times)
+{
+    // The frame is already scaled down to max_height, so the CNN gets it as it is,
+    // upsampled as often as HOG was
+    return cnn(image, upsample_num_times);
+}
+
+int cascade_face_detection_model::fallback_scans() const
+{
+    return fallback_count;
+}
+
+int cascade_face_detection_model::confirmed() const
+{
+    return confirmed_count;
+}
+
+int cascade_face_detection_model::dropped() const
+{
+    return dropped_count;
+}
+
+detector_config detector_config::read(INIReader &config)
+{
+    detector_config detector;
+
+    std::string value = config.Get("core", "use_cnn", "false");
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c)
+                   { return std::tolower(c); });
+
+    if (value == "cascade")
+        detector.mode = cascade;
+    else if (config.GetBoolean("core", "use_cnn", false))
+        detector.mode = cnn;
+
+    detector.cascade_interval = config.GetInteger("core", "cascade_interval", 5);
+    return detector;
+}
+
+std::unique_ptr<face_detection_model> make_face_detector(const detector_config &detector)
+{
+    std::string cnn_file = PATH + "/dlib-data/mmod_human_face_detector.dat";
+
+    switch (detector.mode)
+    {
+    case detector_config::cnn:
+        return std::make_unique<cnn_face_detection_model_v1>(cnn_file);
+    case detector_config::cascade:
+        return std::make_unique<cascade_face_detection_model>(cnn_file, detector.cascade_interval);
+    default:
+        return std::make_unique<frontal_face_detector_model>();
+    }
+}
+
+namespace
+{
+    /*A fixed test pattern, the same chip gives the same answer every time*/
+    matrix<rgb_pixel> test_chip()
+    {
+        matrix<rgb_pixel> chip(150, 150);
+        for (long r = 0; r < chip.nr(); r++)
+            for (long c = 0; c < chip.nc(); c++)
+                chip(r, c) = rgb_pixel((r * 7 + c * 3) % 256, (r * c) % 256, (r + c * 5) % 256);
+        return chip;
+    }
+
+    template <typename T>
+    struct is_con : std::false_type
+    {
+    };
+    template <long num_filters, long nr, long nc, int stride_y, int stride_x, int padding_y, int padding_x>
+    struct is_con<con_<num_filters, nr, nc, stride_y, stride_x, padding_y, padding_x>> : std::true_type
+    {
+    };
+
+    template <typename T>
+    struct is_fc : std::false_type
+    {
+    };
+    template <unsigned long num_outputs, fc_bias_mode bias_mode>
+    struct is_fc<fc_<num_outputs, bias_mode>> : std::true_type
+    {
+    };
+
+    /*Changes whenever the model file or the dlib doing the folding does, without reading the file*/
+    std::string model_fingerprint(const std::string &model_filename)
+    {
+        std::error_code error;
+        auto size = std::filesystem::file_size(model_filename, error);
+        auto modified = std::filesystem::last_write_time(model_filename, error);
+        if (error)
+            return "";
+
+        return std::to_string(size) + " " + std::to_string(modified.time_since_epoch().count()) + " " +
+               std::to_string(DLIB_MAJOR_VERSION) + "." + std::to_string(DLIB_MINOR_VERSION);
+    }
+}
+
+face_recognition_model_v1::face_recognition_model_v1(const std::string &model_filename, bool fuse_layers)
+    : model_version(model_fingerprint(model_filename)),
+      calibration_filename(std::filesystem::path(model_filename).replace_extension(".int8")),
+      fusion_filename(std::filesystem::path(model_filename).replace_extension(".fused")),
+      int8_check_filename(std::filesystem::path(model_filename).replace_extension(".int8check"))
 {
     deserialize(model_filename) >> net;
+    if (fuse_layers)
+        fuse(model_filename);
+}
+
+void face_recognition_model_v1::fuse(const std::string &model_filename)
+{
+    // Whether folding works out for this model is only checked on its first load
+    std::string checked;
+    std::getline(std::ifstream(fusion_filename), checked);
+    if (!model_version.empty() && checked == model_version + " fused")
+    {
+        dlib::fuse_layers(net);
+        fused = true;
+        return;
+    }
+    if (!model_version.empty() && checked == model_version + " unfused")
+        return;
+
+    std::vector<matrix<rgb_pixel>> chips{test_chip()};
+    matrix<float, 0, 1> expected = net(chips)[0];
+
+    // Scales the filters and shifts the biases of every convolution by the
+    // affine layer after it, and turns that layer into a no-op
+    dlib::fuse_layers(net);
+
+    float difference = max(abs(expected - net(chips)[0]));
+    fused = difference <= 1e-3;
+    if (!fused)
+    {
+        syslog(LOG_WARNING, "Face encoder with folded affine layers is off by %f, using it as it is", difference);
+        deserialize(model_filename) >> net;
+    }
+
+    // Only root can write next to the models, others check again next time
+    if (!model_version.empty())
+        std::ofstream(fusion_filename, std::ios::trunc) << model_version << (fused ? " fused" : " unfused") << std::endl;
+}
+
+bool face_recognition_model_v1::is_fused() const
+{
+    return fused;
+}
+
+std::unique_ptr<int8_encoder> face_recognition_model_v1::make_int8_encoder()
+{
+    // The engine only knows convolutions with a bias, the affine layers have to be folded
+    if (!fused)
+        return nullptr;
+
+    std::vector<std::vector<float>> convolutions;
+    std::vector<float> fc;
+    visit_computational_layers(net, [&](auto &layer)
+                               {
+                                   using layer_type = std::decay_t<decltype(layer)>;
+
+                                   if constexpr (is_con<layer_type>::value || is_fc<layer_type>::value)
+                                   {
+                                       const tensor &params = layer.get_layer_params();
+                                       std::vector<float> values(params.host(), params.host() + params.size());
+                                       if constexpr (is_fc<layer_type>::value)
+                                           fc = std::move(values);
+                                       else
+                                           convolutions.push_back(std::move(values));
+                                   } });
+
+    // Visited from the output to the input
+    std::reverse(convolutions.begin(), convolutions.end());
+
+    auto engine = std::make_unique<int8_encoder>();
+    if (!engine->set_parameters(convolutions, fc))
+    {
+        syslog(LOG_WARNING, "The face encoder does not have the layout the int8 engine expects");
+        return nullptr;
+    }
+
+    // The float mode of the engine has to match the network, or its layout is off.
+    // That only changes with the model file, so it is checked on its first use
+    std::string checked;
+    std::getline(std::ifstream(int8_check_filename), checked);
+    if (!model_version.empty() && checked == model_version + " matches")
+        return engine;
+    if (!model_version.empty() && checked == model_version + " differs")
+    {
+        syslog(LOG_WARNING, "The int8 engine did not match the face encoder, not using it");
+        return nullptr;
+    }
+
+    matrix<rgb_pixel> chip = test_chip();
+    std::vector<matrix<rgb_pixel>> chips{chip};
+    matrix<float, 0, 1> expected = net(chips)[0];
+    matrix<float, 0, 1> actual(DESCRIPTOR_SIZE);
+    engine->encode((const unsigned char *)image_data(chip), &actual(0), false);
+
+    float difference = max(abs(expected - actual));
+    bool matches = difference <= 1e-3;
+
+    // Only root can write next to the models, others check again next time
+    if (!model_version.empty())
+        std::ofstream(int8_check_filename, std::ios::trunc) << model_version << (matches ? " matches" : " differs") << std::endl;
+
+    if (!matches)
+    {
+        syslog(LOG_WARNING, "The int8 engine is off by %f from the face encoder, not using it", difference);
+        return nullptr;
+    }
+
+    return engine;
+}
+
+bool face_recognition_model_v1::use_int8(bool enable)
+{
+    if (enable && !quantized && !int8_unavailable)
+    {
+        std::unique_ptr<int8_encoder> engine = make_int8_encoder();
+        if (engine && !engine->load_calibration(calibration_filename))
+        {
+            syslog(LOG_WARNING, "No int8 calibration for the face encoder in %s, run howdy calibrate. Using the float network", calibration_filename.c_str());
+            engine.reset();
+        }
+
+        quantized = std::move(engine);
+        int8_unavailable = !quantized;
+    }
+
+    int8 = enable && quantized;
+    return int8 == enable;
+}
+
+bool face_recognition_model_v1::calibrate_int8(const std::vector<matrix<rgb_pixel>> &chips)
+{
+    std::unique_ptr<int8_encoder> engine = make_int8_encoder();
+    if (!engine || chips.empty())
+        return false;
+
+    std::vector<const unsigned char *> pixels;
+    for (const auto &chip : chips)
+    {
+        if (chip.nr() != int8_encoder::CHIP_SIZE || chip.nc() != int8_encoder::CHIP_SIZE)
+            return false;
+        pixels.push_back((const unsigned char *)image_data(chip));
+    }
+
+    engine->calibrate(pixels);
+    if (!engine->save_calibration(calibration_filename))
+        return false;
+
+    quantized = std::move(engine);
+    int8_unavailable = false;
+    return true;
+}
+
+std::string face_recognition_model_v1::engine() const
+{
+    if (int8)
+        return std::string("int8, ") + int8_encoder::instruction_set();
+
+    return fused ? "float, fused" : "float";
 }
 
 matrix<double, 0, 1> face_recognition_model_v1::compute_face_descriptor(
@@ -76,11 +479,18 @@ matrix<double, 0, 1> face_recognition_model_v1::compute_face_descriptor(
     const int num_jitters,
     float padding)
 {
-    matrix<rgb_pixel> img;
-    convert_image(image, img);
+    std::vector<full_object_detection> faces(1, face);
+    return compute_face_descriptors(image, faces, num_jitters, padding)[0];
+}
 
+matrix<double, 0, 1> face_recognition_model_v1::compute_face_descriptor(
+    image_context &image,
+    const full_object_detection &face,
+    const int num_jitters,
+    float padding)
+{
     std::vector<full_object_detection> faces(1, face);
-    return compute_face_descriptors(img, faces, num_jitters, padding)[0];
+    return compute_face_descriptors(image, faces, num_jitters, padding)[0];
 }
 
 matrix<double, 0, 1> face_recognition_model_v1::compute_face_descriptor(
@@ -101,6 +511,74 @@ matrix<double, 0, 1> face_recognition_model_v1::compute_face_descriptor_from_ali
     return batch_compute_face_descriptors_from_aligned_images(images, num_jitters)[0];
 }
 
+namespace
+{
+    /*Cut the faces out of an image of any pixel type, straight into RGB chips*/
+    template <typename image_type>
+    void extract_face_chips(
+        const image_type &img,
+        const std::vector<full_object_detection> &faces,
+        float padding,
+        std::vector<chip_details> &dets,
+        dlib::array<matrix<rgb_pixel>> &face_chips)
+    {
+        dets.clear();
+        for (const auto &f : faces)
+            dets.push_back(get_face_chip_details(f, 150, padding));
+        extract_image_chips(img, dets, face_chips);
+    }
+
+    /*Check that the landmarks are of a kind the chips can be aligned with*/
+    void check_landmarks(const std::vector<full_object_detection> &faces)
+    {
+        for (const auto &f : faces)
+        {
+            if (f.num_parts() != 68 && f.num_parts() != 5)
+            {
+                syslog(LOG_ERR, "The full_object_detection must use the iBUG 300W 68 point face landmark style or dlib's 5 point style.");
+                exit(1);
+            }
+        }
+    }
+}
+
+std::vector<matrix<double, 0, 1>> face_recognition_model_v1::compute_face_descriptors(
+    cv::Mat &image,
+    const std::vector<full_object_detection> &faces,
+    const int num_jitters,
+    float padding)
+{
+    image_context context(image);
+    return compute_face_descriptors(context, faces, num_jitters, padding);
+}
+
+std::vector<matrix<double, 0, 1>> face_recognition_model_v1::compute_face_descriptors(
+    image_context &image,
+    const std::vector<full_object_detection> &faces,
+    const int num_jitters,
+    float padding)
+{
+    encode_faces(image, faces, num_jitters, padding);
+    return collect_descriptors(chips.size(), num_jitters);
+}
+
+void face_recognition_model_v1::encode_faces(
+    image_context &image,
+    const std::vector<full_object_detection> &faces,
+    const int num_jitters,
+    float padding)
+{
+    check_landmarks(faces);
+
+    // The chips are cut straight out of the frame, it never gets converted as a whole
+    if (image.channels() == 1)
+        extract_face_chips(cv_image<unsigned char>(image.mat()), faces, padding, chip_layouts, chips);
+    else
+        extract_face_chips(cv_image<bgr_pixel>(image.mat()), faces, padding, chip_layouts, chips);
+
+    run_chips(chips, num_jitters);
+}
+
 std::vector<matrix<double, 0, 1>> face_recognition_model_v1::compute_face_descriptors(
     matrix<rgb_pixel> img,
     const std::vector<full_object_detection> &faces,
@@ -125,62 +603,75 @@ std::vector<std::vector<matrix<double, 0, 1>>> face_recognition_model_v1::batch_
         exit(1);
     }
 
-    int total_chips = 0;
     for (const auto &faces : batch_faces)
-    {
-        total_chips += faces.size();
-        for (const auto &f : faces)
-        {
-            if (f.num_parts() != 68 && f.num_parts() != 5)
-            {
-                syslog(LOG_ERR, "The full_object_detection must use the iBUG 300W 68 point face landmark style or dlib's 5 point style.");
-                exit(1);
-            }
-        }
-    }
+        check_landmarks(faces);
 
     dlib::array<matrix<rgb_pixel>> face_chips;
     for (unsigned int i = 0; i < batch_imgs.size(); ++i)
     {
-        auto &faces = batch_faces[i];
-        auto &img = batch_imgs[i];
-
-        std::vector<chip_details> dets;
-        for (const auto &f : faces)
-            dets.push_back(get_face_chip_details(f, 150, padding));
         dlib::array<matrix<rgb_pixel>> this_img_face_chips;
-        extract_image_chips(img, dets, this_img_face_chips);
+        extract_face_chips(batch_imgs[i], batch_faces[i], padding, chip_layouts, this_img_face_chips);
 
         for (auto &chip : this_img_face_chips)
             face_chips.push_back(chip);
     }
 
+    // Split the descriptors of all chips back up per image
+    std::vector<matrix<double, 0, 1>> descriptors = descriptors_of_chips(face_chips, num_jitters);
     std::vector<std::vector<matrix<double, 0, 1>>> face_descriptors(batch_imgs.size());
-    if (num_jitters <= 1)
+    auto next = std::begin(descriptors);
+    for (unsigned int i = 0; i < batch_faces.size(); ++i)
     {
-        // extract descriptors and convert from float vectors to double vectors
-        auto descriptors = net(face_chips, 16);
-        auto next = std::begin(descriptors);
-        for (unsigned int i = 0; i < batch_faces.size(); ++i)
+        for (unsigned int j = 0; j < batch_faces[i].size(); ++j)
         {
-            for (unsigned int j = 0; j < batch_faces[i].size(); ++j)
-            {
-                face_descriptors[i].push_back(matrix_cast<double>(*next++));
-            }
+            face_descriptors[i].push_back(*next++);
         }
     }
+
+    return face_descriptors;
+}
+
+std::vector<matrix<double, 0, 1>> face_recognition_model_v1::descriptors_of_chips(
+    dlib::array<matrix<rgb_pixel>> &face_chips,
+    const int num_jitters)
+{
+    run_chips(face_chips, num_jitters);
+    return collect_descriptors(face_chips.size(), num_jitters);
+}
+
+void face_recognition_model_v1::run_chips(dlib::array<matrix<rgb_pixel>> &face_chips, const int num_jitters)
+{
+    if (num_jitters <= 1)
+    {
+        run_net(face_chips, 16, outputs);
+    }
     else
     {
-        // extract descriptors and convert from float vectors to double vectors
-        auto fimg = std::begin(face_chips);
-        for (unsigned int i = 0; i < batch_faces.size(); ++i)
-        {
-            for (unsigned int j = 0; j < batch_faces[i].size(); ++j)
-            {
-                auto &r = mean(mat(net(jitter_image(*fimg++, num_jitters), 16)));
-                face_descriptors[i].push_back(matrix_cast<double>(r));
-            }
-        }
+        // All jittered crops of all chips go through the network together in large batches
+        jitter_chips(face_chips, num_jitters, crops);
+        run_net(crops, JITTER_BATCH_SIZE, outputs);
+    }
+}
+
+std::vector<matrix<double, 0, 1>> face_recognition_model_v1::collect_descriptors(size_t count, const int num_jitters)
+{
+    std::vector<matrix<double, 0, 1>> face_descriptors;
+    if (num_jitters <= 1)
+    {
+        // convert from float vectors to double vectors
+        for (size_t i = 0; i < count; ++i)
+            face_descriptors.push_back(matrix_cast<double>(outputs[i]));
+        return face_descriptors;
+    }
+
+    // Average the crops of every chip
+    for (size_t i = 0; i < count; ++i)
+    {
+        matrix<float, 0, 1> sum = outputs[i * num_jitters];
+        for (int j = 1; j < num_jitters; ++j)
+            sum += outputs[i * num_jitters + j];
+
+        face_descriptors.push_back(matrix_cast<double>(sum / num_jitters));
     }
 
     return face_descriptors;
@@ -205,48 +696,128 @@ std::vector<matrix<double, 0, 1>> face_recognition_model_v1::batch_compute_face_
         face_chips.push_back(image);
     }
 
-    std::vector<matrix<double, 0, 1>> face_descriptors;
-    if (num_jitters <= 1)
+    return descriptors_of_chips(face_chips, num_jitters);
+}
+
+void face_recognition_model_v1::jitter_chips(
+    const dlib::array<matrix<rgb_pixel>> &face_chips,
+    const int num_jitters,
+    std::vector<matrix<rgb_pixel>> &crops)
+{
+    crops.resize(face_chips.size() * num_jitters);
+
+    // Every crop has its own generator seeded by its position, so the result
+    // does not depend on how the crops are spread over the threads
+    parallel_for(0, long(crops.size()), [&](long i)
+                 {
+                     dlib::rand crop_rnd(jitter_seed + i);
+                     crops[i] = dlib::jitter_image(face_chips[i / num_jitters], crop_rnd);
+                 });
+}
+
+void face_recognition_model_v1::set_jitter_seed(time_t seed)
+{
+    jitter_seed = seed;
+}
+
+shape_predictor_model::shape_predictor_model(const std::string &model_filename)
+{
+    deserialize(model_filename) >> predictor;
+}
+
+full_object_detection shape_predictor_model::operator()(cv::Mat &image, const rectangle &box)
+{
+    image_context context(image);
+    return (*this)(context, box);
+}
+
+full_object_detection shape_predictor_model::operator()(image_context &image, const rectangle &box)
+{
+    // The predictor only compares pixel intensities, it can read either kind of frame in place
+    if (image.channels() == 1)
+        return predictor(cv_image<unsigned char>(image.mat()), box);
+
+    return predictor(cv_image<bgr_pixel>(image.mat()), box);
+}
+
+void recognition_models::load(const detector_config &detector_settings, bool use_int8)
+{
+    // Applied to the encoder when it is handed out, whether it is loaded again or not
+    int8 = use_int8;
+
+    // Keep the models we have if the detector settings did not change
+    if (loaded && settings == detector_settings)
     {
-        // extract descriptors and convert from float vectors to double vectors
-        auto descriptors = net(face_chips, 16);
+        detector_time = predictor_time = encoder_time = std::chrono::duration<double>(0);
+        return;
+    }
 
-        for (auto &des : descriptors)
-        {
-            face_descriptors.push_back(matrix_cast<double>(des));
-        }
+    load_clock::time_point start = load_clock::now();
+
+    detector_time = std::chrono::duration<double>(0);
+    detector_loader = std::async(std::launch::async, [this, detector_settings, start]()
+                                 {
+        std::unique_ptr<face_detection_model> model = make_face_detector(detector_settings);
+        detector_time = load_clock::now() - start;
+        return model; });
+
+    // The others are the same for all detectors, only load them once
+    if (!loaded)
+    {
+        predictor_loader = std::async(std::launch::async, [this, start]()
+                                      {
+            auto model = std::make_unique<shape_predictor_model>(PATH + "/dlib-data/shape_predictor_5_face_landmarks.dat");
+            predictor_time = load_clock::now() - start;
+            return model; });
+
+        encoder_loader = std::async(std::launch::async, [this, start, use_int8]()
+                                    {
+            auto model = std::make_unique<face_recognition_model_v1>(PATH + "/dlib-data/dlib_face_recognition_resnet_model_v1.dat");
+            model->use_int8(use_int8);
+            encoder_time = load_clock::now() - start;
+            return model; });
     }
     else
     {
-        // extract descriptors and convert from float vectors to double vectors
-        for (auto &fimg : face_chips)
-        {
-            auto &r = mean(mat(net(jitter_image(fimg, num_jitters), 16)));
-            face_descriptors.push_back(matrix_cast<double>(r));
-        }
+        predictor_time = encoder_time = std::chrono::duration<double>(0);
     }
-    return face_descriptors;
+
+    loaded = true;
+    settings = detector_settings;
 }
 
-std::vector<matrix<rgb_pixel>> face_recognition_model_v1::jitter_image(
-    const matrix<rgb_pixel> &img,
-    const int num_jitters)
+void recognition_models::wait()
 {
-    std::vector<matrix<rgb_pixel>> crops;
-    for (int i = 0; i < num_jitters; ++i)
-        crops.push_back(dlib::jitter_image(img, rnd));
-    return crops;
+    face_detector();
+    pose_predictor();
+    face_encoder();
 }
 
-shape_predictor_model::shape_predictor_model(const std::string &model_filename)
+face_detection_model &recognition_models::face_detector()
 {
-    deserialize(model_filename) >> predictor;
+    if (detector_loader.valid())
+        detector = detector_loader.get();
+    return *detector;
 }
 
-full_object_detection shape_predictor_model::operator()(cv::Mat &image, const rectangle &box)
+shape_predictor_model &recognition_models::pose_predictor()
 {
-    matrix<rgb_pixel> img;
-    convert_image(image, img);
+    if (predictor_loader.valid())
+        predictor = predictor_loader.get();
+    return *predictor;
+}
 
-    return predictor(img, box);
+face_recognition_model_v1 &recognition_models::face_encoder()
+{
+    if (encoder_loader.valid())
+        encoder = encoder_loader.get();
+    // Nothing to do unless the setting changed since the encoder was loaded
+    encoder->use_int8(int8);
+    return *encoder;
+}
+
+std::chrono::duration<double> recognition_models::load_time()
+{
+    wait();
+    return std::max({detector_time, predictor_time, encoder_time});
 }
@@ -1,14 +1,25 @@
 #ifndef MODELS_H_
 #define MODELS_H_
 
+#include <algorithm>
 #include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
 
 #include <opencv2/videoio.hpp>
 
 #include <dlib/opencv.h>
 #include <dlib/dnn.h>
+#include <dlib/threads.h>
 #include <dlib/image_processing/frontal_face_detector.h>
 
+#include <INIReader.h>
+
+#include "image_context.hpp"
+#include "int8_encoder.hpp"
+#include "model_store.hpp"
+
 using namespace dlib;
 
 class face_detection_model
@@ -17,9 +28,36 @@ class face_detection_model
 public:
     virtual ~face_detection_model() = default;
 
+    /*
+    Finds the faces in an 8 bit gray or BGR image
+    */
     std::vector<rectangle> operator()(cv::Mat &image, const int upsample_num_times);
 
-    virtual std::vector<rectangle> detect(matrix<rgb_pixel> &image);
+    /*
+    Finds the faces in a frame. Gray frames are read in place by models that
+    can, everything else uses the RGB image of the context.
+    */
+    virtual std::vector<rectangle> operator()(image_context &image, const int upsample_num_times);
+
+    /*
+    Scales the frame up into the workspace, the first step of operator().
+    On its own so the workspace can be checked for allocations.
+    */
+    void upsample(image_context &image, const int upsample_num_times);
+
+    virtual std::vector<rectangle> detect(const matrix<rgb_pixel> &image);
+
+    /*
+    Detection on grayscale images, only used if reads_gray() is true
+    */
+    virtual bool reads_gray() const;
+    virtual std::vector<rectangle> detect_gray(const cv_image<unsigned char> &image);
+    virtual std::vector<rectangle> detect_gray(const matrix<unsigned char> &image);
+
+private:
+    // Upsampled frames, kept between calls so frames of the same size reuse them
+    matrix<unsigned char> gray_levels[2];
+    matrix<rgb_pixel> rgb_levels[2];
 };
 
 class cnn_face_detection_model_v1 : public face_detection_model
@@ -30,7 +68,7 @@ public:
 
     virtual ~cnn_face_detection_model_v1() = default;
 
-    virtual std::vector<rectangle> detect(matrix<rgb_pixel> &image);
+    virtual std::vector<rectangle> detect(const matrix<rgb_pixel> &image);
 
 private:
     template <long num_filters, typename SUBNET>
@@ -56,17 +94,106 @@ public:
 
     virtual ~frontal_face_detector_model() = default;
 
-    virtual std::vector<rectangle> detect(matrix<rgb_pixel> &image);
+    virtual std::vector<rectangle> detect(const matrix<rgb_pixel> &image);
+
+    // HOG features only look at the intensity, so gray images are used as they are
+    virtual bool reads_gray() const;
+    virtual std::vector<rectangle> detect_gray(const cv_image<unsigned char> &image);
+    virtual std::vector<rectangle> detect_gray(const matrix<unsigned char> &image);
 
 private:
     frontal_face_detector detector;
 };
 
+/*
+HOG on the whole frame, with the CNN only looking at a padded crop around
+every HOG hit to confirm it and refine its box. Hits the CNN does not
+confirm are dropped.
+
+Faces HOG can't see at all, turned away or badly lit, are looked for by
+the CNN on the whole frame, upsampled as often as for HOG, on every
+fallback_interval-th frame in a row without a face. A fallback_interval of 0 turns that off.
+*/
+class cascade_face_detection_model : public face_detection_model
+{
+
+public:
+    cascade_face_detection_model(const std::string &model_filename, int fallback_interval);
+
+    virtual ~cascade_face_detection_model() = default;
+
+    using face_detection_model::operator();
+    virtual std::vector<rectangle> operator()(image_context &image, const int upsample_num_times);
+
+    /*
+    Frames searched by the CNN as a whole, and HOG hits it confirmed or dropped
+    */
+    int fallback_scans() const;
+    int confirmed() const;
+    int dropped() const;
+
+private:
+    // Width the faces are scaled to in the crops the CNN confirms them in
+    static constexpr double CROP_FACE_SIZE = 80;
+    // Smallest overlap of a CNN box with a HOG hit to confirm it
+    static constexpr double MIN_OVERLAP = 0.3;
+
+    frontal_face_detector_model hog;
+    cnn_face_detection_model_v1 cnn;
+
+    int fallback_interval;
+    int misses = 0;
+
+    int fallback_count = 0;
+    int confirmed_count = 0;
+    int dropped_count = 0;
+
+    /*
+    Runs the CNN around a HOG hit, and sets face to its box if it agrees
+    */
+    bool confirm(image_context &image, const rectangle &hit, rectangle &face);
+
+    /*
+    Runs the CNN on the whole frame, for faces HOG missed
+    */
+    std::vector<rectangle> search_full_frame(image_context &image, const int upsample_num_times);
+};
+
+/*
+The detector the config asks for. use_cnn is false for HOG, true for the
+CNN, or cascade for HOG confirmed by the CNN.
+*/
+struct detector_config
+{
+    enum mode_type
+    {
+        hog,
+        cnn,
+        cascade
+    };
+
+    mode_type mode = hog;
+    // Frames without a face between two full frame CNN searches in cascade mode
+    int cascade_interval = 5;
+
+    static detector_config read(INIReader &config);
+
+    bool operator==(const detector_config &other) const = default;
+};
+
+std::unique_ptr<face_detection_model> make_face_detector(const detector_config &detector);
+
 class face_recognition_model_v1
 {
 
 public:
-    face_recognition_model_v1(const std::string &model_filename);
+    /*
+    Loads the network and folds its affine layers into the convolutions in
+    front of them, unless fuse_layers is false. Folding is checked against
+    the original network on the first load of a model file, and the result
+    is kept next to it, so later loads skip the check.
+    */
+    face_recognition_model_v1(const std::string &model_filename, bool fuse_layers = true);
 
     matrix<double, 0, 1> compute_face_descriptor(
         cv::Mat &image,
@@ -74,6 +201,12 @@ public:
         const int num_jitters,
         float padding = 0.25);
 
+    matrix<double, 0, 1> compute_face_descriptor(
+        image_context &image,
+        const full_object_detection &face,
+        const int num_jitters,
+        float padding = 0.25);
+
     matrix<double, 0, 1> compute_face_descriptor(
         matrix<rgb_pixel> img,
         const full_object_detection &face,
@@ -84,12 +217,39 @@ public:
         matrix<rgb_pixel> img,
         const int num_jitters);
 
+    /*
+    Encodes all faces of an 8 bit gray or BGR image in one pass through the
+    network. Only the face chips are converted to RGB, not the whole image.
+    */
+    std::vector<matrix<double, 0, 1>> compute_face_descriptors(
+        cv::Mat &image,
+        const std::vector<full_object_detection> &faces,
+        const int num_jitters,
+        float padding = 0.25);
+
+    std::vector<matrix<double, 0, 1>> compute_face_descriptors(
+        image_context &image,
+        const std::vector<full_object_detection> &faces,
+        const int num_jitters,
+        float padding = 0.25);
+
     std::vector<matrix<double, 0, 1>> compute_face_descriptors(
         matrix<rgb_pixel> img,
         const std::vector<full_object_detection> &faces,
         const int num_jitters,
         float padding = 0.25);
 
+    /*
+    The part of compute_face_descriptors that cuts the chips and runs the
+    network, its results stay in the workspaces below. On its own so those
+    can be checked for allocations.
+    */
+    void encode_faces(
+        image_context &image,
+        const std::vector<full_object_detection> &faces,
+        const int num_jitters,
+        float padding = 0.25);
+
     std::vector<std::vector<matrix<double, 0, 1>>> batch_compute_face_descriptors(
         const std::vector<matrix<rgb_pixel>> &batch_imgs,
         const std::vector<std::vector<full_object_detection>> &batch_faces,
@@ -100,13 +260,73 @@ public:
         const std::vector<matrix<rgb_pixel>> &batch_imgs,
         const int num_jitters);
 
+    /*
+    Jittered descriptors are the same for the same seed, 0 unless set
+    */
+    void set_jitter_seed(time_t seed);
+
+    /*
+    Whether the affine layers have been folded into the convolutions
+    */
+    bool is_fused() const;
+
+    /*
+    Switch to the 8 bit integer engine. It needs the fused network and the
+    calibration file next to the model, written by calibrate_int8(). Returns
+    false, and keeps using the float network, if either is missing.
+    */
+    bool use_int8(bool enable);
+
+    /*
+    Calibrates the 8 bit integer engine on aligned 150x150 face chips and
+    writes the result next to the model
+    */
+    bool calibrate_int8(const std::vector<matrix<rgb_pixel>> &chips);
+
+    /*
+    The network descriptors are computed with, for reports
+    */
+    std::string engine() const;
+
 private:
-    dlib::rand rnd;
+    // Crops per forward pass when jittering
+    static const int JITTER_BATCH_SIZE = 64;
+
+    time_t jitter_seed = 0;
+
+    /*
+    Workspaces kept between calls, so encoding the same number of faces
+    again does not allocate them again. Neither does the network, its
+    tensors only ever grow.
+    */
+    std::vector<chip_details> chip_layouts;
+    dlib::array<matrix<rgb_pixel>> chips;
+    std::vector<matrix<rgb_pixel>> crops;
+    std::vector<matrix<float, 0, 1>> outputs;
+
+    /*
+    Fills crops with num_jitters randomly jittered crops of every chip, made
+    in parallel
+    */
+    void jitter_chips(
+        const dlib::array<matrix<rgb_pixel>> &face_chips,
+        const int num_jitters,
+        std::vector<matrix<rgb_pixel>> &crops);
 
-    std::vector<matrix<rgb_pixel>> jitter_image(
-        const matrix<rgb_pixel> &img,
+    std::vector<matrix<double, 0, 1>> descriptors_of_chips(
+        dlib::array<matrix<rgb_pixel>> &face_chips,
         const int num_jitters);
 
+    /*
+    Runs the chips, or num_jitters crops of each, through the network into outputs
+    */
+    void run_chips(dlib::array<matrix<rgb_pixel>> &face_chips, const int num_jitters);
+
+    /*
+    The descriptors of the first count chips of the last run, out of outputs
+    */
+    std::vector<matrix<double, 0, 1>> collect_descriptors(size_t count, const int num_jitters);
+
     template <template <int, template <typename> class, int, typename> class block, int N, template <typename> class BN, typename SUBNET>
     using residual = add_prev1<block<N, BN, 1, tag1<SUBNET>>>;
 
@@ -135,6 +355,59 @@ private:
     using anet_type = loss_metric<fc_no_bias<128, avg_pool_everything<alevel0<alevel1<alevel2<alevel3<alevel4<max_pool<3, 3, 2, 2, relu<affine<con<32, 7, 7, 2, 2, input_rgb_image_sized<150>>>>>>>>>>>>>;
 
     anet_type net;
+    bool fused = false;
+
+    // Size and time of the model file and the dlib version, see fuse()
+    std::string model_version;
+    std::string calibration_filename;
+    // Records whether folding worked for the model file, see fuse()
+    std::string fusion_filename;
+    // Records whether the int8 engine matched the fused network, see make_int8_encoder()
+    std::string int8_check_filename;
+    std::unique_ptr<int8_encoder> quantized;
+    bool int8 = false;
+    // Set once the engine could not be set up, so it is not tried on every frame
+    bool int8_unavailable = false;
+
+    /*
+    Folds the affine layers of net, and goes back to the original network if
+    the results differ
+    */
+    void fuse(const std::string &model_filename);
+
+    /*
+    An integer engine with the parameters of the fused net, checked against it
+    the first time the model file is used. Not calibrated yet, nullptr if it
+    can't be set up.
+    */
+    std::unique_ptr<int8_encoder> make_int8_encoder();
+
+    /*
+    Writes the descriptors of chips to descriptors, batch_size chips at a time
+    */
+    template <typename iterable_type>
+    void run_net(const iterable_type &chips, size_t batch_size, std::vector<matrix<float, 0, 1>> &descriptors)
+    {
+        descriptors.resize(chips.size());
+
+        if (int8)
+        {
+            // The engine works on one chip at a time, so the chips are spread over the threads
+            parallel_for(0, long(chips.size()), [&](long i)
+                         {
+                             descriptors[i].set_size(DESCRIPTOR_SIZE);
+                             quantized->encode((const unsigned char *)image_data(chips[i]), &descriptors[i](0));
+                         });
+            return;
+        }
+
+        for (size_t start = 0; start < chips.size(); start += batch_size)
+        {
+            auto first = std::begin(chips) + start;
+            auto last = std::begin(chips) + std::min(start + batch_size, chips.size());
+            net(first, last, descriptors.begin() + start);
+        }
+    }
 };
 
 class shape_predictor_model
@@ -142,12 +415,67 @@ class shape_predictor_model
 public:
     shape_predictor_model(const std::string &model_filename);
 
+    /*
+    Finds the landmarks of a face in an 8 bit gray or BGR image, which is
+    read in place
+    */
     full_object_detection operator()(cv::Mat &image, const rectangle &box);
+    full_object_detection operator()(image_context &image, const rectangle &box);
 
 private:
     shape_predictor predictor;
 };
 
+/*
+Owns the detector, the landmark predictor and the face encoder, so they can
+be loaded once and kept in memory between authentication attempts.
+*/
+class recognition_models
+{
+public:
+    /*
+    Starts loading the models from the dlib-data folder, each on its own
+    thread so the caller can open the camera in the meantime. Does nothing if
+    they have already been loaded with the same detector settings. use_int8
+    picks the engine of the face encoder, see face_recognition_model_v1.
+    */
+    void load(const detector_config &detector_settings, bool use_int8 = false);
+
+    /*
+    Wait for all models to be loaded
+    */
+    void wait();
+
+    /*
+    The accessors block until their model has finished loading
+    */
+    face_detection_model &face_detector();
+    shape_predictor_model &pose_predictor();
+    face_recognition_model_v1 &face_encoder();
+
+    /*
+    Time between the last call to load and the slowest model being ready,
+    zero if nothing had to be loaded
+    */
+    std::chrono::duration<double> load_time();
 
+private:
+    bool loaded = false;
+    detector_config settings;
+    bool int8 = false;
+
+    std::future<std::unique_ptr<face_detection_model>> detector_loader;
+    std::future<std::unique_ptr<shape_predictor_model>> predictor_loader;
+    std::future<std::unique_ptr<face_recognition_model_v1>> encoder_loader;
+
+    std::unique_ptr<face_detection_model> detector;
+    std::unique_ptr<shape_predictor_model> predictor;
+    std::unique_ptr<face_recognition_model_v1> encoder;
+
+    // Written by the loading threads, read after their future is done
+    std::chrono::duration<double> detector_time{0};
+    std::chrono::duration<double> predictor_time{0};
+    std::chrono::duration<double> encoder_time{0};
+};
 
 #endif // MODELS_H_
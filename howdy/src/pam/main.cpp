@@ -5,12 +5,15 @@
 
 #include <glob.h>
 #include <libintl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <spawn.h>
 #include <stdexcept>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/syslog.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <syslog.h>
 #include <unistd.h>
@@ -38,6 +41,7 @@
 #include <security/pam_ext.h>
 #include <security/pam_modules.h>
 
+#include "../authd_protocol.hpp"
 #include "enter_device.hpp"
 #include "main.hpp"
 #include "optional_task.hpp"
@@ -134,6 +138,148 @@ auto howdy_status(char *username, int status, const INIReader &config,
   return PAM_SUCCESS;
 }
 
+/**
+ * Wait until fd has data to read or the deadline passes
+ * @param  fd       The socket
+ * @param  deadline When to give up
+ * @return          Returns false if the deadline passed first
+ */
+auto wait_readable(int fd, std::chrono::steady_clock::time_point deadline)
+    -> bool
+{
+  while (true)
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         deadline - std::chrono::steady_clock::now())
+                         .count();
+    if (remaining <= 0)
+    {
+      return false;
+    }
+
+    struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+    int ready = poll(&pfd, 1, static_cast<int>(remaining));
+    if (ready > 0)
+    {
+      return true;
+    }
+    if (ready < 0 && errno != EINTR)
+    {
+      return false;
+    }
+  }
+}
+
+/**
+ * Read exactly size bytes from fd, giving up at the deadline
+ * @param  fd       The socket
+ * @param  buffer   Where to put the bytes
+ * @param  size     Number of bytes to read
+ * @param  deadline When to give up
+ * @return          Returns false on timeout, error or a closed connection
+ */
+auto read_until(int fd, void *buffer, size_t size,
+                std::chrono::steady_clock::time_point deadline) -> bool
+{
+  auto *bytes = static_cast<char *>(buffer);
+  size_t done = 0;
+  while (done < size)
+  {
+    if (!wait_readable(fd, deadline))
+    {
+      return false;
+    }
+
+    ssize_t n = recv(fd, bytes + done, size - done, 0);
+    if (n <= 0)
+    {
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    done += n;
+  }
+
+  return true;
+}
+
+/**
+ * Ask the howdy-authd daemon to run the comparison, it has the face
+ * recognition models loaded already
+ * @param  username Username
+ * @param  config   INI configuration, for the video timeout
+ * @param  status   Set to the wait status of the compare process
+ * @return          Returns AuthdResult::UNAVAILABLE if the daemon could not
+ * be reached or did not take the request, in which case the compare process
+ * has to be spawned instead
+ */
+auto authd_identify(const char *username, const INIReader &config,
+                    int &status) -> AuthdResult
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+  {
+    return AuthdResult::UNAVAILABLE;
+  }
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, AUTHD_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) !=
+      0)
+  {
+    close(fd);
+    return AuthdResult::UNAVAILABLE;
+  }
+
+  // Username first, then the session variables the auth ui needs
+  std::string request = std::string(username) + "\n";
+  for (const auto *name : AUTHD_FORWARDED_ENV)
+  {
+    const char *value = getenv(name);
+    if (value != nullptr)
+    {
+      request += std::string(name) + "=" + value + "\n";
+    }
+  }
+  request += "\n";
+
+  // A hung daemon must not hang the login, so every read has a deadline
+  auto request_deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(AUTHD_REQUEST_TIMEOUT);
+  char state = 0;
+  bool accepted =
+      send(fd, request.c_str(), request.size(), MSG_NOSIGNAL) ==
+          static_cast<ssize_t>(request.size()) &&
+      read_until(fd, &state, sizeof(state), request_deadline);
+
+  if (!accepted)
+  {
+    close(fd);
+    syslog(LOG_ERR, "howdy-authd did not answer the request");
+    return AuthdResult::UNAVAILABLE;
+  }
+
+  // The daemon owns the attempt now, it may take as long as the video timeout
+  auto result_deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::seconds(config.GetInteger("video", "timeout", 4) +
+                           AUTHD_RESULT_MARGIN);
+  bool received = read_until(fd, &status, sizeof(status), result_deadline);
+  close(fd);
+
+  if (!received)
+  {
+    syslog(LOG_ERR, "Lost connection to howdy-authd during the attempt");
+    return AuthdResult::LOST;
+  }
+
+  return AuthdResult::DONE;
+}
+
 /**
  * Check if Howdy should be enabled according to the configuration and the
  * environment.
@@ -280,6 +426,24 @@ auto identify(pam_handle_t *pamh, int flags, int argc, const char **argv,
     return pam_res;
   }
 
+  int status;
+
+  // Use the daemon if it's running, it saves loading the models
+  if (config.GetBoolean("core", "use_daemon", true))
+  {
+    switch (authd_identify(username, config, status))
+    {
+    case AuthdResult::DONE:
+      return howdy_status(username, status, config, conv_function);
+    case AuthdResult::LOST:
+      // The daemon may still be using the camera, a second attempt would
+      // fight it for the device
+      return PAM_AUTH_ERR;
+    case AuthdResult::UNAVAILABLE:
+      break;
+    }
+  }
+
   // const char *const args[] = {PYTHON_EXECUTABLE, // NOLINT
   //                             COMPARE_PROCESS_PATH, username, nullptr};
   const char *const args[] = {"/lib64/security/howdy/howdy-auth",
@@ -297,7 +461,6 @@ auto identify(pam_handle_t *pamh, int flags, int argc, const char **argv,
     return PAM_SYSTEM_ERR;
   }
 
-  int status;
   waitpid(child_pid, &status, 0);
 
   return howdy_status(username, status, config, conv_function);
@@ -7,6 +7,16 @@ enum class ConfirmationType { Unset, Howdy, Pam };
 
 enum class Workaround { Off, Input, Native };
 
+// How a request to howdy-authd ended
+enum class AuthdResult {
+  // Not reached or did not take the request, howdy-auth has to run instead
+  UNAVAILABLE,
+  // Took the request but the result never came
+  LOST,
+  // The status of the attempt was received
+  DONE
+};
+
 // Exit status codes returned by the compare process
 enum CompareError : int {
   NO_FACE_MODEL = 10,
@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <chrono>
+
+#include <opencv2/imgproc.hpp>
+
+#include <dlib/opencv.h>
+
+#include "pipeline.hpp"
+#include "image_context.hpp"
+#include "upsample_policy.hpp"
+#include "trace.hpp"
+
+namespace
+{
+    typedef std::chrono::steady_clock stage_clock;
+
+    /*Adds the time since start to a list of stage timings, if they are recorded*/
+    void lap(std::vector<double> *list, stage_clock::time_point &start)
+    {
+        stage_clock::time_point end = stage_clock::now();
+        if (list)
+            list->push_back(std::chrono::duration<double>(end - start).count());
+        start = end;
+    }
+}
+
+recognition_pipeline::recognition_pipeline(INIReader &config_, VideoCapture &video_capture_, recognition_models &recognition_, const descriptor_matcher &matcher_)
+    : video_capture(video_capture_), recognition(recognition_), matcher(matcher_), config(config_),
+      dark_threshold(config.GetReal("video", "dark_threshold", 50.0)),
+      certainty(config.GetReal("video", "certainty", 3.5) / 10),
+      rotate(config.GetInteger("video", "rotate", 0)),
+      exposure(config.GetInteger("video", "exposure", -1)),
+      clahe(cv::createCLAHE(2.0, cv::Size(8, 8))),
+      preprocessed(2),
+      detected(2),
+      // Frames change orientation all the time when rotating, so only track without it
+      face_tracking(rotate == 0 ? config.GetInteger("video", "tracking_interval", 8) : 0, config.GetReal("video", "tracking_padding", 0.5)),
+      face_quality(config),
+      descriptor_reuse(config)
+{
+    // Get the height of the image (which would be the width if screen is portrait oriented)
+    height = video_capture.get(cv::CAP_PROP_FRAME_HEIGHT);
+    if (rotate == 2)
+    {
+        height = video_capture.get(cv::CAP_PROP_FRAME_WIDTH);
+    }
+    if (height == 0)
+    {
+        height = 1;
+    }
+
+    // Calculate the amount the image has to shrink
+    scaling_factor = config.GetReal("video", "max_height", 0.0) / height;
+    if (scaling_factor == 0)
+    {
+        scaling_factor = 1;
+    }
+}
+
+recognition_pipeline::~recognition_pipeline()
+{
+    stop();
+}
+
+void recognition_pipeline::keep_color_frames(size_t count)
+{
+    color_frame_count = count;
+}
+
+void recognition_pipeline::record_timings(pipeline_timings *timings_)
+{
+    timings = timings_;
+}
+
+void recognition_pipeline::start()
+{
+    frame_count = 0;
+    capture_thread = std::thread(&recognition_pipeline::capture_stage, this);
+    detect_thread = std::thread(&recognition_pipeline::detect_stage, this);
+}
+
+void recognition_pipeline::stop()
+{
+    stopping = true;
+    preprocessed.shutdown();
+    detected.shutdown();
+    if (capture_thread.joinable())
+        capture_thread.join();
+    if (detect_thread.joinable())
+        detect_thread.join();
+}
+
+/*Capture and preprocess stage, runs on its own thread*/
+void recognition_pipeline::capture_stage()
+{
+    // Keeps its buffers between frames
+    frame_preprocessor preprocessor(scaling_factor, clahe);
+    trace::name_thread("capture");
+
+    while (!stopping)
+    {
+        stage_clock::time_point started = stage_clock::now();
+
+        // Grab a single frame of video
+        cv::Mat raw;
+        bool captured;
+        {
+            trace::span span("camera read");
+            captured = video_capture.read_raw(raw);
+        }
+        if (!captured)
+        {
+            // The recording is over, let the other stages know once they got everything before it
+            pipeline_frame end;
+            end.end = true;
+            preprocessed.push(end);
+            break;
+        }
+        lap(timings ? &timings->capture : nullptr, started);
+
+        // Increment the frame count every loop
+        int frame_number = ++frame_count;
+
+        if (exposure != -1)
+        {
+            trace::span span("exposure");
+            // For a strange reason on some cameras (e.g. Lenoxo X1E) setting manual exposure works only after a couple frames
+            // are captured and even after a delay it does not always work. Setting exposure at every frame is reliable though.
+            video_capture.set(cv::CAP_PROP_AUTO_EXPOSURE, 1.0); // 1 = Manual
+            video_capture.set(cv::CAP_PROP_EXPOSURE, double(exposure));
+        }
+
+        // Start capturing frames for the snapshot, only these are needed in color
+        if (snapframes.size() < color_frame_count)
+        {
+            trace::span span("snapshot color");
+            cv::Mat color;
+            video_capture.read_color(color);
+            snapframes.push_back(color);
+        }
+        // Kept out of the preprocess time, the ioctls can take as long as the frame itself
+        lap(timings ? &timings->camera_control : nullptr, started);
+
+        pipeline_frame item;
+        bool usable = preprocess(raw, frame_number, preprocessor, item);
+        lap(timings ? &timings->preprocess : nullptr, started);
+        if (!usable)
+            continue;
+
+        // Blocks while the detector is still busy with earlier frames
+        if (!preprocessed.push(item))
+            break;
+    }
+}
+
+bool recognition_pipeline::preprocess(const cv::Mat &raw, int frame_number, frame_preprocessor &preprocessor, pipeline_frame &item)
+{
+    // Flashing IR emitters make a lot of frames unusable, the darkness is
+    // measured on a sample of the raw frame so those are dropped before
+    // anything else is done with them. The bound is cheaper still and catches
+    // the darkest frames before the CLAHE tables are built, it never exceeds
+    // the measured darkness
+    double darkness;
+    {
+        trace::span span("darkness");
+        darkness = preprocessor.dark_bound(raw);
+        if (darkness < 100 && darkness <= dark_threshold)
+            darkness = preprocessor.measure(raw);
+    }
+
+    // If the image is fully black due to a bad camera read,
+    // skip to the next frame
+    if (darkness == 100)
+    {
+        black_tries += 1;
+        return false;
+    }
+
+    dark_running_total += darkness;
+    valid_count += 1;
+    // If the image exceeds darkness threshold due to subject distance,
+    // skip to the next frame
+    if (darkness > dark_threshold)
+    {
+        dark_tries += 1;
+        return false;
+    }
+
+    // Scale down to max_height, convert and enhance
+    cv::Mat &frame = item.frame;
+    cv::Mat &gsframe = item.gsframe;
+    preprocessor.enhance(raw, frame, gsframe);
+
+    trace::span span("rotate");
+    cv::Mat tempframe;
+    // If camera is configured to rotate = 1, check portrait in addition to landscape
+    if (rotate == 1)
+    {
+        if (frame_number % 3 == 1)
+        {
+            cv::rotate(frame, tempframe, cv::ROTATE_90_COUNTERCLOCKWISE);
+            frame = tempframe;
+            cv::rotate(gsframe, tempframe, cv::ROTATE_90_COUNTERCLOCKWISE);
+            gsframe = tempframe;
+        }
+        if (frame_number % 3 == 2)
+        {
+            cv::rotate(frame, tempframe, cv::ROTATE_90_CLOCKWISE);
+            frame = tempframe;
+            cv::rotate(gsframe, tempframe, cv::ROTATE_90_CLOCKWISE);
+            gsframe = tempframe;
+        }
+    }
+    // If camera is configured to rotate = 2, check portrait orientation
+    else if (rotate == 2)
+    {
+        if (frame_number % 2 == 0)
+        {
+            cv::rotate(frame, tempframe, cv::ROTATE_90_COUNTERCLOCKWISE);
+            frame = tempframe;
+            cv::rotate(gsframe, tempframe, cv::ROTATE_90_COUNTERCLOCKWISE);
+            gsframe = tempframe;
+        }
+        else
+        {
+            cv::rotate(frame, tempframe, cv::ROTATE_90_CLOCKWISE);
+            frame = tempframe;
+            cv::rotate(gsframe, tempframe, cv::ROTATE_90_CLOCKWISE);
+            gsframe = tempframe;
+        }
+    }
+
+    return true;
+}
+
+/*Detection and landmarking stage, runs on its own thread*/
+void recognition_pipeline::detect_stage()
+{
+    // Wait for the models here, the camera is already capturing meanwhile
+    face_detection_model &face_detector = recognition.face_detector();
+    shape_predictor_model &pose_predictor = recognition.pose_predictor();
+    // Only used by this stage, so it needs no locking
+    upsample_policy upsample(config);
+    trace::name_thread("detect");
+
+    pipeline_frame item;
+    while (preprocessed.waitAndPop(item))
+    {
+        if (item.end)
+        {
+            detected.push(item);
+            break;
+        }
+
+        stage_clock::time_point started = stage_clock::now();
+
+        // Get all faces from that frame as encodings, near the last face if there was one
+        item.upsample = upsample.level();
+        std::vector<rectangle> face_locations;
+        {
+            trace::span span("detect");
+            face_locations = face_tracking.detect(face_detector, item.gsframe, item.upsample);
+        }
+        upsample.update(face_locations);
+        lap(timings ? &timings->detect : nullptr, started);
+
+        // Nothing to encode, don't bother the next stage
+        if (face_locations.empty())
+            continue;
+
+        // Fetch the faces in the image, leaving out the ones not worth encoding
+        {
+            trace::span span("landmark");
+            image_context color(item.frame);
+            for (auto &&fl : face_locations)
+            {
+                full_object_detection face_landmark = pose_predictor(color, fl);
+                if (face_quality.accept(face_landmark, item.gsframe))
+                    item.face_landmarks.push_back(face_landmark);
+            }
+        }
+        lap(timings ? &timings->landmark : nullptr, started);
+
+        if (item.face_landmarks.empty())
+            continue;
+
+        if (!detected.push(item))
+            break;
+    }
+}
+
+recognition_pipeline::result_type recognition_pipeline::step(int wait_ms, match_result &found)
+{
+    pipeline_frame item;
+    if (!detected.tryWaitAndPop(item, wait_ms))
+        return waiting;
+
+    if (item.end)
+        return ended;
+
+    stage_clock::time_point started = stage_clock::now();
+
+    // Only needed once there's a face, so it gets the most time to load
+    face_recognition_model_v1 &face_encoder = recognition.face_encoder();
+
+    // Shared by all faces, so the frame is never converted more than once
+    image_context color(item.frame);
+
+    // Faces that did not change since an earlier frame keep their descriptor
+    std::vector<matrix<double, 0, 1>> face_encodings(item.face_landmarks.size());
+    std::vector<full_object_detection> new_faces;
+    std::vector<descriptor_cache::key> new_keys;
+    std::vector<size_t> new_positions;
+    for (size_t i = 0; i < item.face_landmarks.size(); i++)
+    {
+        if (descriptor_reuse.enabled())
+        {
+            descriptor_cache::key face_key = descriptor_reuse.make_key(item.face_landmarks[i], item.gsframe);
+            if (descriptor_reuse.lookup(face_key, face_encodings[i]))
+                continue;
+            new_keys.push_back(face_key);
+        }
+
+        new_faces.push_back(item.face_landmarks[i]);
+        new_positions.push_back(i);
+    }
+
+    // Encode all other faces in the frame with one pass through the network
+    if (!new_faces.empty())
+    {
+        trace::span span("encode");
+        std::vector<matrix<double, 0, 1>> new_encodings = face_encoder.compute_face_descriptors(color, new_faces, 1);
+        for (size_t i = 0; i < new_faces.size(); i++)
+        {
+            face_encodings[new_positions[i]] = new_encodings[i];
+            if (descriptor_reuse.enabled())
+                descriptor_reuse.store(new_keys[i], new_encodings[i]);
+        }
+        lap(timings ? &timings->encode : nullptr, started);
+    }
+
+    // Loop through each face, the first good match ends the search
+    trace::span span("match");
+    result_type result = no_match;
+    for (auto &&face_encoding : face_encodings)
+    {
+        // Match this found face against all known faces in one pass
+        float query[DESCRIPTOR_SIZE];
+        std::copy(face_encoding.begin(), face_encoding.end(), query);
+        descriptor_match best = matcher.best_match(query);
+
+        // Update certainty if we have a new low
+        if (lowest > best.distance)
+        {
+            lowest = best.distance;
+        }
+
+        // Check if a match that's confident enough
+        if (0 < best.distance && best.distance < certainty)
+        {
+            found.best = best;
+            found.frame = item.frame;
+            found.upsample = item.upsample;
+            result = match;
+            break;
+        }
+    }
+    lap(timings ? &timings->match : nullptr, started);
+
+    return result;
+}
+
+double recognition_pipeline::native_height() const
+{
+    return height;
+}
+
+int recognition_pipeline::frames() const
+{
+    return frame_count;
+}
+
+int recognition_pipeline::black_frames() const
+{
+    return black_tries;
+}
+
+int recognition_pipeline::dark_frames() const
+{
+    return dark_tries;
+}
+
+int recognition_pipeline::valid_frames() const
+{
+    return valid_count;
+}
+
+double recognition_pipeline::average_darkness() const
+{
+    return dark_running_total / std::max(1, int(valid_count));
+}
+
+double recognition_pipeline::lowest_certainty() const
+{
+    return lowest;
+}
+
+const face_tracker &recognition_pipeline::tracker() const
+{
+    return face_tracking;
+}
+
+const face_quality_gate &recognition_pipeline::quality() const
+{
+    return face_quality;
+}
+
+const descriptor_cache &recognition_pipeline::descriptors() const
+{
+    return descriptor_reuse;
+}
+
+const std::vector<cv::Mat> &recognition_pipeline::color_frames() const
+{
+    return snapframes;
+}
@@ -0,0 +1,197 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <INIReader.h>
+
+#include "models.hpp"
+#include "video_capture.hpp"
+#include "descriptor_matcher.hpp"
+#include "descriptor_cache.hpp"
+#include "face_tracker.hpp"
+#include "face_quality.hpp"
+#include "frame_preprocessor.hpp"
+
+#include "utils/blocking_queue.hpp"
+
+/*A frame on its way through the recognition pipeline*/
+struct pipeline_frame
+{
+    cv::Mat frame;
+    cv::Mat gsframe;
+    std::vector<full_object_detection> face_landmarks;
+    // Times the frame was upsampled to find the faces
+    int upsample = 0;
+    // Set on an empty item after the last frame of a replayed recording
+    bool end = false;
+};
+
+/*
+Time every frame spent in each stage of the pipeline, in seconds. Every list
+is written by the thread running its stage only, read them after stop().
+*/
+struct pipeline_timings
+{
+    // Waiting for the camera and reading the frame
+    std::vector<double> capture;
+    // Setting the exposure and reading color frames for the snapshot
+    std::vector<double> camera_control;
+    // Darkness checks, scaling, CLAHE and rotation, nothing that talks to the camera
+    std::vector<double> preprocess;
+    std::vector<double> detect;
+    // Landmarks and the quality gate, for frames with faces
+    std::vector<double> landmark;
+    // Frames with faces that were not in the descriptor cache
+    std::vector<double> encode;
+    std::vector<double> match;
+};
+
+/*
+The stages of an authentication attempt, from camera frames to matched
+descriptors.
+
+Frames are captured and preprocessed on one thread, searched for faces and
+landmarked on a second one, and encoded and matched on the thread calling
+step(). The stages hand frames to each other through queues of two, so a
+fast stage waits for the slowest one instead of piling up frames.
+*/
+class recognition_pipeline
+{
+public:
+    enum result_type
+    {
+        // No frame with faces came in time
+        waiting,
+        // The faces of a frame were matched, none closely enough
+        no_match,
+        // A face matched closer than the certainty in the config
+        match,
+        // A replayed recording has no frames left
+        ended,
+    };
+
+    // The face that ended the search
+    struct match_result
+    {
+        descriptor_match best;
+        // The scaled down frame it was found in
+        cv::Mat frame;
+        int upsample = 0;
+    };
+
+    /*
+    Reads the [video] settings. The camera, the models and the matcher have
+    to outlive the pipeline.
+    */
+    recognition_pipeline(INIReader &config, VideoCapture &video_capture, recognition_models &recognition, const descriptor_matcher &matcher);
+
+    /*
+    Stops the stages if they are still running
+    */
+    ~recognition_pipeline();
+
+    /*
+    Keep the first count captured frames in color, for snapshots
+    */
+    void keep_color_frames(size_t count);
+
+    /*
+    Record how long every frame takes in each stage. Has to be called
+    before start(), timings has to outlive the pipeline.
+    */
+    void record_timings(pipeline_timings *timings);
+
+    /*
+    Starts the capture and detection threads
+    */
+    void start();
+
+    /*
+    Stops the other stages, needed before anything else can use the camera
+    or the detector. Frames still in the queues are dropped.
+    */
+    void stop();
+
+    /*
+    Waits up to wait_ms for the next frame with faces, then encodes and
+    matches them. The first face that matches well enough ends the search
+    and is written to found.
+    */
+    result_type step(int wait_ms, match_result &found);
+
+    /*
+    Height of the camera frames before scaling, after rotation
+    */
+    double native_height() const;
+
+    /*
+    Counters of the frames so far, safe to read while running
+    */
+    int frames() const;
+    int black_frames() const;
+    int dark_frames() const;
+    int valid_frames() const;
+    double average_darkness() const;
+    double lowest_certainty() const;
+
+    /*
+    The stages themselves, read them after stop()
+    */
+    const face_tracker &tracker() const;
+    const face_quality_gate &quality() const;
+    const descriptor_cache &descriptors() const;
+    const std::vector<cv::Mat> &color_frames() const;
+
+private:
+    VideoCapture &video_capture;
+    recognition_models &recognition;
+    const descriptor_matcher &matcher;
+    INIReader &config;
+
+    double dark_threshold;
+    double certainty;
+    int rotate;
+    int exposure;
+    double height;
+    double scaling_factor;
+    cv::Ptr<cv::CLAHE> clahe;
+
+    BlockingQueue<pipeline_frame> preprocessed;
+    BlockingQueue<pipeline_frame> detected;
+    std::atomic<bool> stopping = false;
+    std::thread capture_thread;
+    std::thread detect_thread;
+
+    std::atomic<int> frame_count = 0;
+    std::atomic<int> black_tries = 0;
+    std::atomic<int> dark_tries = 0;
+    std::atomic<int> valid_count = 0;
+    std::atomic<double> dark_running_total = 0;
+    // Only touched by the thread calling step()
+    double lowest = 10;
+
+    size_t color_frame_count = 0;
+    std::vector<cv::Mat> snapframes;
+    pipeline_timings *timings = nullptr;
+
+    face_tracker face_tracking;
+    face_quality_gate face_quality;
+    descriptor_cache descriptor_reuse;
+
+    void capture_stage();
+    void detect_stage();
+
+    /*
+    Turns a raw frame into the frames the detector and the encoder take.
+    Returns false if the frame is too dark to use.
+    */
+    bool preprocess(const cv::Mat &raw, int frame_number, frame_preprocessor &preprocessor, pipeline_frame &item);
+};
+
+#endif // PIPELINE_H_
@@ -0,0 +1,170 @@
+#include <sys/syslog.h>
+#include <syslog.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <thread>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "replay_capture.hpp"
+
+namespace fs = std::filesystem;
+
+bool replay_capture::open(const std::string &path, pacing_type pacing_, double fps_)
+{
+    release();
+    pacing = pacing_;
+    fps = fps_ > 0 ? fps_ : 30;
+
+    if (fs::is_directory(path))
+    {
+        source = images;
+        for (const fs::directory_entry &entry : fs::directory_iterator(path))
+        {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (entry.is_regular_file() && extension == ".png")
+                image_files.push_back(entry.path().string());
+        }
+        std::sort(image_files.begin(), image_files.end());
+
+        if (image_files.empty())
+        {
+            syslog(LOG_ERR, "There are no PNG images to replay in %s", path.c_str());
+            return false;
+        }
+
+        // The rest of the pipeline only takes 8 bit gray or BGR frames, so
+        // alpha is dropped and 16 bit images are scaled down by imread
+        first_image = cv::imread(image_files[0], cv::IMREAD_UNCHANGED);
+        if (first_image.empty())
+        {
+            syslog(LOG_ERR, "Can't read %s", image_files[0].c_str());
+            return false;
+        }
+        image_mode = first_image.channels() <= 2 ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+        first_image = cv::imread(image_files[0], image_mode);
+        width = first_image.cols;
+        height = first_image.rows;
+    }
+    else if (frame_dump_reader::is_dump(path))
+    {
+        source = dump;
+        if (!dump_reader.open(path))
+        {
+            syslog(LOG_ERR, "%s is a frame dump this version of howdy can't read", path.c_str());
+            return false;
+        }
+        width = dump_reader.header().width;
+        height = dump_reader.header().height;
+    }
+    else
+    {
+        source = video;
+        if (!video_file.open(path))
+        {
+            syslog(LOG_ERR, "Can't open %s as a video", path.c_str());
+            return false;
+        }
+        width = video_file.get(cv::CAP_PROP_FRAME_WIDTH);
+        height = video_file.get(cv::CAP_PROP_FRAME_HEIGHT);
+        double rate = video_file.get(cv::CAP_PROP_FPS);
+        if (rate > 0)
+            fps = rate;
+    }
+
+    return true;
+}
+
+void replay_capture::release()
+{
+    video_file.release();
+    image_files.clear();
+    dump_reader = frame_dump_reader();
+    first_image.release();
+    next_frame = 0;
+    width = 0;
+    height = 0;
+}
+
+bool replay_capture::read(cv::Mat &frame)
+{
+    // Frames of a video or of images are spread evenly over time
+    double seconds = next_frame / fps;
+
+    switch (source)
+    {
+    case images:
+        if (next_frame >= image_files.size())
+            return false;
+        if (next_frame == 0)
+            frame = first_image;
+        else
+            frame = cv::imread(image_files[next_frame], image_mode);
+        first_image.release();
+        if (frame.empty())
+        {
+            syslog(LOG_ERR, "Can't read %s", image_files[next_frame].c_str());
+            return false;
+        }
+        break;
+    case dump:
+        if (!dump_reader.read(frame, seconds))
+            return false;
+        break;
+    case video:
+        if (!video_file.read(frame))
+            return false;
+        break;
+    }
+
+    if (next_frame == 0)
+        started = std::chrono::steady_clock::now();
+    next_frame++;
+
+    pace(seconds);
+    return true;
+}
+
+void replay_capture::pace(double seconds)
+{
+    if (pacing == fast)
+        return;
+
+    std::this_thread::sleep_until(started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+}
+
+double replay_capture::get(int propId)
+{
+    switch (propId)
+    {
+    case cv::CAP_PROP_FRAME_WIDTH:
+        return width;
+    case cv::CAP_PROP_FRAME_HEIGHT:
+        return height;
+    case cv::CAP_PROP_FPS:
+        return fps;
+    default:
+        return 0;
+    }
+}
+
+bool replay_capture::set(int propId, double value)
+{
+    return false;
+}
+
+std::string replay_capture::describe() const
+{
+    switch (source)
+    {
+    case images:
+        return std::to_string(image_files.size()) + " PNG images";
+    case dump:
+        return "frame dump";
+    default:
+        return "video file";
+    }
+}
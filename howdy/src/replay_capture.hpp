@@ -0,0 +1,94 @@
+#ifndef REPLAY_CAPTURE_H_
+#define REPLAY_CAPTURE_H_
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "frame_dump.hpp"
+
+/*
+Plays recorded frames back as if they came from a camera, so the whole
+pipeline can run, and be timed, without one. The recording can be a video
+file, a directory of PNG images that are played in the order of their names,
+or a raw frame dump. Frames always come out as 8 bit gray or BGR, like they
+do from a camera: gray PNGs, with or without alpha, are played as gray and
+all others as BGR, 16 bit ones scaled down to 8.
+
+Frames are either paced like they were recorded or handed out as fast as
+they are asked for. Unlike a camera, a recording ends: read() returns false
+after the last frame.
+*/
+class replay_capture
+{
+public:
+    enum pacing_type
+    {
+        // Every frame waits until its time since the first frame has passed
+        realtime,
+        // No waiting at all
+        fast,
+    };
+
+    /*
+    Opens the recording at path. fps is the rate PNG images are played at,
+    video files and frame dumps carry their own timing. Returns false,
+    after logging why, if there is nothing to play.
+    */
+    bool open(const std::string &path, pacing_type pacing, double fps);
+
+    void release();
+
+    /*
+    Sets frame to the next frame of the recording, returns false at the end
+    */
+    bool read(cv::Mat &frame);
+
+    /*
+    The frame size and rate, exposure can't be changed on a recording
+    */
+    double get(int propId);
+    bool set(int propId, double value);
+
+    /*
+    Short description of the source, for the logs
+    */
+    std::string describe() const;
+
+private:
+    enum source_type
+    {
+        video,
+        images,
+        dump,
+    };
+
+    source_type source = video;
+    pacing_type pacing = realtime;
+    double fps = 30;
+
+    cv::VideoCapture video_file;
+    std::vector<std::string> image_files;
+    // How the images are read, decided by the first one
+    int image_mode = cv::IMREAD_COLOR;
+    frame_dump_reader dump_reader;
+
+    // The first image, read by open() to know the frame size
+    cv::Mat first_image;
+    size_t next_frame = 0;
+    int width = 0;
+    int height = 0;
+
+    std::chrono::steady_clock::time_point started;
+
+    /*
+    Waits until a frame seconds after the first one is due
+    */
+    void pace(double seconds);
+};
+
+#endif // REPLAY_CAPTURE_H_
@@ -8,6 +8,7 @@
 
 #include "utils.hpp"
 #include "rubber_stamps.hpp"
+#include "upsample_policy.hpp"
 #include "keyboard/keyboard.hpp"
 
 using namespace std::literals;
@@ -114,19 +115,25 @@ public:
 
 		time_point starttime = now();
 
+		// Frames are not scaled down here, so faces are usually large enough without upsampling
+		upsample_policy upsample(config);
+
 		// Keep running the loop while we have not hit timeout yet
 		while (now() < starttime + std::chrono::seconds(int(round(std::get<double>(options["timeout"])))))
 		{
 			// Read a frame from the camera
 			cv::Mat ret, tempframe;
 			cv::Mat frame;
-			opencv.video_capture.read_frame(ret, tempframe);
+			// A replayed recording that runs out of frames counts as a timeout
+			if (!opencv.video_capture.read_frame(ret, tempframe))
+				break;
 
 			// Apply CLAHE to get a better picture
 			opencv.clahe->apply(tempframe, frame);
 
 			// Detect all faces in the frame
-			std::vector<rectangle> face_locations = opencv.face_detector(frame, 1);
+			std::vector<rectangle> face_locations = opencv.face_detector(frame, upsample.level());
+			upsample.update(face_locations);
 
 			// Only continue if exacty 1 face is visible in the frame
 			if (face_locations.size() != 1)
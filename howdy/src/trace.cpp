@@ -0,0 +1,135 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define FMT_HEADER_ONLY
+#include "fmt/core.h"
+
+#include "trace.hpp"
+
+std::atomic<bool> trace::active = false;
+
+namespace
+{
+    struct event
+    {
+        const char *name;
+        int64_t start;
+        int64_t end;
+    };
+
+    struct thread_buffer
+    {
+        int id;
+        // Guarded by registry_lock, the owner may rename the thread while dumping
+        std::string name;
+
+        std::array<event, trace::BUFFER_SPANS> events;
+        // Spans ever written, only the owning thread changes it
+        std::atomic<uint64_t> written = 0;
+    };
+
+    // Buffers of all threads that recorded anything, they outlive their threads
+    std::mutex registry_lock;
+    std::vector<std::shared_ptr<thread_buffer>> registry;
+
+    /*The buffer of the calling thread, registered the first time*/
+    thread_buffer &own_buffer()
+    {
+        thread_local std::shared_ptr<thread_buffer> buffer;
+        if (!buffer)
+        {
+            buffer = std::make_shared<thread_buffer>();
+            std::lock_guard<std::mutex> lock(registry_lock);
+            buffer->id = registry.size() + 1;
+            registry.push_back(buffer);
+        }
+        return *buffer;
+    }
+}
+
+void trace::enable(bool on)
+{
+    active.store(on, std::memory_order_relaxed);
+}
+
+void trace::name_thread(const char *name)
+{
+    if (!enabled())
+        return;
+
+    thread_buffer &buffer = own_buffer();
+    std::lock_guard<std::mutex> lock(registry_lock);
+    buffer.name = name;
+}
+
+int64_t trace::now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace::record(const char *name, int64_t start_ns, int64_t end_ns)
+{
+    thread_buffer &buffer = own_buffer();
+    uint64_t index = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[index % BUFFER_SPANS] = {name, start_ns, end_ns};
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+bool trace::dump(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(registry_lock);
+
+    // Spans still in the buffers, oldest first
+    struct thread_spans
+    {
+        const thread_buffer *buffer;
+        uint64_t first;
+        uint64_t last;
+    };
+    std::vector<thread_spans> threads;
+    int64_t origin = INT64_MAX;
+    for (const std::shared_ptr<thread_buffer> &buffer : registry)
+    {
+        uint64_t last = buffer->written.load(std::memory_order_acquire);
+        uint64_t first = last > BUFFER_SPANS ? last - BUFFER_SPANS : 0;
+        threads.push_back({buffer.get(), first, last});
+        for (uint64_t i = first; i < last; i++)
+            origin = std::min(origin, buffer->events[i % BUFFER_SPANS].start);
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+        return false;
+
+    // Times are in microseconds from the first span
+    int pid = getpid();
+    bool first_event = true;
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    for (const thread_spans &thread : threads)
+    {
+        if (!thread.buffer->name.empty())
+        {
+            file << (first_event ? "\n" : ",\n")
+                 << fmt::format(R"({{"name": "thread_name", "ph": "M", "pid": {}, "tid": {}, "args": {{"name": "{}"}}}})", pid, thread.buffer->id, thread.buffer->name);
+            first_event = false;
+        }
+
+        for (uint64_t i = thread.first; i < thread.last; i++)
+        {
+            const event &span = thread.buffer->events[i % BUFFER_SPANS];
+            file << (first_event ? "\n" : ",\n")
+                 << fmt::format(R"({{"name": "{}", "ph": "X", "pid": {}, "tid": {}, "ts": {:.3f}, "dur": {:.3f}}})", span.name, pid, thread.buffer->id, (span.start - origin) / 1e3, (span.end - span.start) / 1e3);
+            first_event = false;
+        }
+    }
+    file << "\n]}\n";
+
+    return bool(file);
+}
@@ -0,0 +1,79 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+Records how long the stages of an authentication attempt take, on every
+thread, to see where a slow attempt spent its time.
+
+A span is timed from its construction to the end of its scope. Every
+thread writes its spans to its own ring buffer without locking, the oldest
+spans are overwritten once it is full. While tracing is off, a span costs
+one relaxed atomic load. dump() writes all buffers as Chrome trace JSON,
+which chrome://tracing and ui.perfetto.dev open.
+*/
+namespace trace
+{
+    // Spans kept per thread
+    const size_t BUFFER_SPANS = 8192;
+
+    extern std::atomic<bool> active;
+
+    /*
+    Turns recording on or off for all threads
+    */
+    void enable(bool on);
+
+    inline bool enabled()
+    {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    /*
+    Name of the calling thread in the trace
+    */
+    void name_thread(const char *name);
+
+    /*
+    Nanoseconds on the steady clock
+    */
+    int64_t now_ns();
+
+    /*
+    Adds a finished span to the buffer of the calling thread. name has to
+    live as long as the program, like a string literal.
+    */
+    void record(const char *name, int64_t start_ns, int64_t end_ns);
+
+    /*
+    Writes the spans of all threads to path. Threads should be idle or
+    stopped, spans they write meanwhile may come out garbled.
+    */
+    bool dump(const std::string &path);
+
+    class span
+    {
+    public:
+        explicit span(const char *name_) : name(enabled() ? name_ : nullptr), start(name ? now_ns() : 0)
+        {
+        }
+
+        ~span()
+        {
+            if (name)
+                record(name, start, now_ns());
+        }
+
+        span(const span &) = delete;
+        span &operator=(const span &) = delete;
+
+    private:
+        const char *name;
+        int64_t start;
+    };
+}
+
+#endif // TRACE_H_
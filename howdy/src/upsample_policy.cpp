@@ -0,0 +1,43 @@
+#include <algorithm>
+
+#include "upsample_policy.hpp"
+
+upsample_policy::upsample_policy(INIReader &config)
+{
+    std::string mode = config.GetString("video", "upsample", "adaptive");
+
+    adaptive = mode == "adaptive";
+    max_level = std::max(0L, adaptive ? config.GetInteger("video", "max_upsample", 1) : config.GetInteger("video", "upsample", 1));
+    min_face_size = config.GetInteger("video", "min_face_size", 100);
+    current = adaptive ? 0 : max_level;
+}
+
+int upsample_policy::level() const
+{
+    return current;
+}
+
+void upsample_policy::update(const std::vector<dlib::rectangle> &faces)
+{
+    if (!adaptive)
+        return;
+
+    // Nothing found, look closer in the next frame. Start over after the
+    // highest level, the face might just have been out of view
+    if (faces.empty())
+    {
+        current = current < max_level ? current + 1 : 0;
+        return;
+    }
+
+    long smallest = std::min_element(faces.begin(), faces.end(), [](const dlib::rectangle &a, const dlib::rectangle &b)
+                                     { return a.width() < b.width(); })
+                        ->width();
+
+    // Small faces are easily missed at this level, large ones are found with less.
+    // Sizes are in frame pixels whatever the level, so this does not flip back and forth
+    if (smallest < min_face_size)
+        current = std::min(current + 1, max_level);
+    else
+        current = std::max(current - 1, 0);
+}
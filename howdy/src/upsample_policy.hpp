@@ -0,0 +1,43 @@
+#ifndef UPSAMPLE_POLICY_H_
+#define UPSAMPLE_POLICY_H_
+
+#include <vector>
+
+#include <INIReader.h>
+
+#include <dlib/geometry/rectangle.h>
+
+/*
+Decides how many times a frame is upsampled before face detection.
+
+Every upsample doubles both sides of the frame, so the detector scans four
+times the pixels. In adaptive mode frames are not upsampled at first, and the
+level only goes up when no face was found or the last face was smaller than
+min_face_size pixels. It goes back down once faces are large enough again.
+*/
+class upsample_policy
+{
+public:
+    /*
+    Reads the upsample, max_upsample and min_face_size keys from [video]
+    */
+    upsample_policy(INIReader &config);
+
+    /*
+    Number of times to upsample the next frame
+    */
+    int level() const;
+
+    /*
+    Adjust the level after detecting faces at the current one
+    */
+    void update(const std::vector<dlib::rectangle> &faces);
+
+private:
+    bool adaptive;
+    int max_level;
+    long min_face_size;
+    int current;
+};
+
+#endif // UPSAMPLE_POLICY_H_
@@ -1,25 +1,52 @@
 #pragma once
 #include <queue>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 
 template <typename T>
 class BlockingQueue
 {
 public:
-    BlockingQueue() : _shutdown(false) {}
+    BlockingQueue() : _shutdown(false), capacity(0) {}
+
+    // A queue that holds at most _capacity items, push blocks while it's full
+    explicit BlockingQueue(size_t _capacity) : _shutdown(false), capacity(_capacity) {}
 
     ~BlockingQueue() {
         // shutdown();
     }
 
-    void push(T const &_data)
+    bool push(T const &_data)
+    {
+        {
+            std::unique_lock<std::mutex> lock(guard);
+            if (capacity > 0)
+            {
+                space.wait(lock, [this]() { return _shutdown || queue.size() < capacity; });
+
+                // Nobody is going to take it anymore
+                if (_shutdown)
+                    return false;
+            }
+            queue.push(_data);
+        }
+        signal.notify_one();
+        return true;
+    }
+
+    // Like push, but gives up instead of waiting when the queue is full
+    bool tryPush(T const &_data)
     {
         {
             std::lock_guard<std::mutex> lock(guard);
+            if (_shutdown || (capacity > 0 && queue.size() >= capacity))
+                return false;
             queue.push(_data);
         }
         signal.notify_one();
+        return true;
     }
 
     bool empty() const
@@ -38,6 +65,7 @@ public:
 
         _value = queue.front();
         queue.pop();
+        space.notify_one();
         return true;
     }
 
@@ -50,6 +78,7 @@ public:
         {
             _value = queue.front();
             queue.pop();
+            space.notify_one();
             return true;
         }
 
@@ -67,17 +96,24 @@ public:
 
         _value = queue.front();
         queue.pop();
+        space.notify_one();
         return true;
     }
 
     void shutdown() {
-        _shutdown = true;
+        {
+            std::lock_guard<std::mutex> lock(guard);
+            _shutdown = true;
+        }
         signal.notify_all();
+        space.notify_all();
     }
 
 private:
     std::atomic<bool> _shutdown;
+    size_t capacity;
     std::queue<T> queue;
     mutable std::mutex guard;
     std::condition_variable signal;
+    std::condition_variable space;
 };
@@ -0,0 +1,341 @@
+#include <sys/syslog.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/videodev2.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "v4l2_capture.hpp"
+
+namespace
+{
+    /*ioctl that is tried again when a signal interrupts it*/
+    int xioctl(int fd, unsigned long request, void *arg)
+    {
+        int result;
+        do
+        {
+            result = ioctl(fd, request, arg);
+        } while (result == -1 && errno == EINTR);
+        return result;
+    }
+
+    /*Whether the device offers a pixel format*/
+    bool offers(int fd, uint32_t pixel_format)
+    {
+        v4l2_fmtdesc description = {};
+        description.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        while (xioctl(fd, VIDIOC_ENUM_FMT, &description) == 0)
+        {
+            if (description.pixelformat == pixel_format)
+                return true;
+            description.index++;
+        }
+        return false;
+    }
+}
+
+v4l2_capture::~v4l2_capture()
+{
+    release();
+}
+
+bool v4l2_capture::open(const std::string &device, int requested_width, int requested_height)
+{
+    release();
+
+    fd = ::open(device.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        syslog(LOG_ERR, "Can't open %s: %s (%d)", device.c_str(), strerror(errno), errno);
+        return false;
+    }
+
+    v4l2_capability capability = {};
+    if (xioctl(fd, VIDIOC_QUERYCAP, &capability) < 0)
+    {
+        syslog(LOG_ERR, "%s is not a V4L2 device", device.c_str());
+        release();
+        return false;
+    }
+
+    uint32_t caps = capability.capabilities & V4L2_CAP_DEVICE_CAPS ? capability.device_caps : capability.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+    {
+        syslog(LOG_ERR, "%s can't stream video frames", device.c_str());
+        release();
+        return false;
+    }
+
+    // GREY needs no work at all, YUYV has the luma in every other byte
+    v4l2_format format = {};
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_G_FMT, &format) < 0)
+    {
+        syslog(LOG_ERR, "Can't get the pixel format of %s", device.c_str());
+        release();
+        return false;
+    }
+
+    if (offers(fd, V4L2_PIX_FMT_GREY))
+        format.fmt.pix.pixelformat = V4L2_PIX_FMT_GREY;
+    else if (offers(fd, V4L2_PIX_FMT_YUYV))
+        format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+    else
+    {
+        syslog(LOG_ERR, "The v4l2 recording plugin needs a camera with GREY or YUYV frames, %s has neither", device.c_str());
+        release();
+        return false;
+    }
+
+    if (requested_width > 0)
+        format.fmt.pix.width = requested_width;
+    if (requested_height > 0)
+        format.fmt.pix.height = requested_height;
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+
+    // The driver picks the closest size it has, and may still refuse the format
+    if (xioctl(fd, VIDIOC_S_FMT, &format) < 0 ||
+        (format.fmt.pix.pixelformat != V4L2_PIX_FMT_GREY && format.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV))
+    {
+        syslog(LOG_ERR, "Can't set the pixel format of %s", device.c_str());
+        release();
+        return false;
+    }
+
+    pixel_format = format.fmt.pix.pixelformat;
+    width = format.fmt.pix.width;
+    height = format.fmt.pix.height;
+    int pixel_size = pixel_format == V4L2_PIX_FMT_YUYV ? 2 : 1;
+    bytes_per_line = std::max<int>(format.fmt.pix.bytesperline, width * pixel_size);
+
+    v4l2_requestbuffers request = {};
+    request.count = BUFFER_COUNT;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &request) < 0 || request.count < 2)
+    {
+        syslog(LOG_ERR, "Can't get streaming buffers from %s", device.c_str());
+        release();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < request.count; i++)
+    {
+        v4l2_buffer info = {};
+        info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        info.memory = V4L2_MEMORY_MMAP;
+        info.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &info) < 0)
+        {
+            release();
+            return false;
+        }
+
+        void *start = mmap(nullptr, info.length, PROT_READ, MAP_SHARED, fd, info.m.offset);
+        if (start == MAP_FAILED)
+        {
+            syslog(LOG_ERR, "Can't map the buffers of %s: %s (%d)", device.c_str(), strerror(errno), errno);
+            release();
+            return false;
+        }
+        buffers.push_back({start, info.length});
+
+        if (xioctl(fd, VIDIOC_QBUF, &info) < 0)
+        {
+            release();
+            return false;
+        }
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0)
+    {
+        syslog(LOG_ERR, "Can't start streaming from %s: %s (%d)", device.c_str(), strerror(errno), errno);
+        release();
+        return false;
+    }
+    streaming = true;
+    sequence_known = false;
+    skipped = 0;
+
+    return true;
+}
+
+void v4l2_capture::release()
+{
+    if (streaming)
+    {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(fd, VIDIOC_STREAMOFF, &type);
+        streaming = false;
+    }
+
+    for (const buffer &mapped : buffers)
+        munmap(mapped.start, mapped.length);
+    buffers.clear();
+    current = -1;
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool v4l2_capture::requeue()
+{
+    if (current < 0)
+        return true;
+
+    v4l2_buffer info = {};
+    info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    info.memory = V4L2_MEMORY_MMAP;
+    info.index = current;
+    current = -1;
+    return xioctl(fd, VIDIOC_QBUF, &info) == 0;
+}
+
+bool v4l2_capture::read(cv::Mat &gray)
+{
+    if (!streaming || !requeue())
+        return false;
+
+    while (true)
+    {
+        pollfd wait = {fd, POLLIN, 0};
+        int ready = poll(&wait, 1, READ_TIMEOUT_MS);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            return false;
+
+        v4l2_buffer info = {};
+        info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        info.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(fd, VIDIOC_DQBUF, &info) < 0)
+        {
+            if (errno == EAGAIN)
+                continue;
+            return false;
+        }
+
+        current = info.index;
+
+        // The driver numbers every frame it captures, the ones missing were dropped
+        if (sequence_known && info.sequence > next_sequence)
+            skipped += info.sequence - next_sequence;
+        next_sequence = info.sequence + 1;
+        sequence_known = true;
+
+        // A frame the driver flags as broken is handed back for the next one
+        if (info.flags & V4L2_BUF_FLAG_ERROR || info.bytesused < size_t(bytes_per_line) * (height - 1))
+        {
+            skipped++;
+            if (!requeue())
+                return false;
+            continue;
+        }
+
+        break;
+    }
+
+    if (pixel_format == V4L2_PIX_FMT_GREY)
+    {
+        gray = raw_view();
+    }
+    else
+    {
+        cv::extractChannel(raw_view(), luma, 0);
+        gray = luma;
+    }
+
+    return true;
+}
+
+void v4l2_capture::color(cv::Mat &bgr)
+{
+    if (current < 0)
+    {
+        bgr.release();
+        return;
+    }
+
+    if (pixel_format == V4L2_PIX_FMT_GREY)
+        cv::cvtColor(raw_view(), bgr, cv::COLOR_GRAY2BGR);
+    else
+        cv::cvtColor(raw_view(), bgr, cv::COLOR_YUV2BGR_YUYV);
+}
+
+cv::Mat v4l2_capture::raw_view() const
+{
+    int type = pixel_format == V4L2_PIX_FMT_YUYV ? CV_8UC2 : CV_8UC1;
+    return cv::Mat(height, width, type, buffers[current].start, bytes_per_line);
+}
+
+int v4l2_capture::control(uint32_t id, int *value, bool write)
+{
+    v4l2_control setting = {};
+    setting.id = id;
+    setting.value = *value;
+    int result = xioctl(fd, write ? VIDIOC_S_CTRL : VIDIOC_G_CTRL, &setting);
+    *value = setting.value;
+    return result;
+}
+
+double v4l2_capture::get(int propId)
+{
+    int value = 0;
+    switch (propId)
+    {
+    case cv::CAP_PROP_FRAME_WIDTH:
+        return width;
+    case cv::CAP_PROP_FRAME_HEIGHT:
+        return height;
+    case cv::CAP_PROP_FOURCC:
+        return pixel_format;
+    case cv::CAP_PROP_AUTO_EXPOSURE:
+        return control(V4L2_CID_EXPOSURE_AUTO, &value, false) == 0 ? value : -1;
+    case cv::CAP_PROP_EXPOSURE:
+        return control(V4L2_CID_EXPOSURE_ABSOLUTE, &value, false) == 0 ? value : -1;
+    default:
+        return 0;
+    }
+}
+
+bool v4l2_capture::set(int propId, double value)
+{
+    // Like OpenCV's V4L backend, the values go to the driver as they are
+    int setting = int(value);
+    switch (propId)
+    {
+    case cv::CAP_PROP_AUTO_EXPOSURE:
+        return control(V4L2_CID_EXPOSURE_AUTO, &setting, true) == 0;
+    case cv::CAP_PROP_EXPOSURE:
+        return control(V4L2_CID_EXPOSURE_ABSOLUTE, &setting, true) == 0;
+    default:
+        // The frame size can't change while streaming
+        return false;
+    }
+}
+
+long v4l2_capture::dropped() const
+{
+    return skipped;
+}
+
+std::string v4l2_capture::format() const
+{
+    char code[5] = {char(pixel_format & 0xff), char(pixel_format >> 8 & 0xff), char(pixel_format >> 16 & 0xff), char(pixel_format >> 24 & 0xff), 0};
+    return code;
+}
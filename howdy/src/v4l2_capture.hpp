@@ -0,0 +1,112 @@
+#ifndef V4L2_CAPTURE_H_
+#define V4L2_CAPTURE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+/*
+Reads frames straight from a V4L2 device through memory mapped streaming
+buffers, for cameras that deliver GREY or YUYV frames, which is what IR
+cameras do.
+
+The luma of a frame is handed out without going through BGR: GREY frames
+as a view of the buffer the driver filled, YUYV frames as a copy of their
+Y bytes. The color version of a frame is only made when it is asked for.
+*/
+class v4l2_capture
+{
+public:
+    v4l2_capture() = default;
+
+    /*
+    Stops streaming and closes the device
+    */
+    ~v4l2_capture();
+
+    v4l2_capture(const v4l2_capture &) = delete;
+    v4l2_capture &operator=(const v4l2_capture &) = delete;
+
+    /*
+    Opens the device and starts streaming. A width or height of -1 keeps
+    what the device is set to. Returns false, after logging why, if the
+    device can't stream GREY or YUYV frames.
+    */
+    bool open(const std::string &device, int width, int height);
+
+    void release();
+
+    /*
+    Waits for the next frame and sets gray to its luma. gray is only valid
+    until the next call, its buffer goes back to the driver then.
+    */
+    bool read(cv::Mat &gray);
+
+    /*
+    The frame of the last read in BGR, converted now
+    */
+    void color(cv::Mat &bgr);
+
+    /*
+    The OpenCV properties howdy uses: the frame size, the pixel format and
+    the exposure
+    */
+    double get(int propId);
+    bool set(int propId, double value);
+
+    /*
+    Four character code of the pixel format in use
+    */
+    std::string format() const;
+
+    /*
+    Frames lost since the device was opened: skipped in the sequence numbers
+    of the driver, or delivered broken
+    */
+    long dropped() const;
+
+private:
+    // Buffers in flight, the driver fills one while the last one is read
+    static const int BUFFER_COUNT = 4;
+    // Longest wait for a frame before the camera is given up on
+    static const int READ_TIMEOUT_MS = 5000;
+
+    struct buffer
+    {
+        void *start;
+        size_t length;
+    };
+
+    int fd = -1;
+    bool streaming = false;
+    std::vector<buffer> buffers;
+    // Buffer of the last frame, handed back to the driver on the next read
+    int current = -1;
+
+    uint32_t pixel_format = 0;
+    int width = 0;
+    int height = 0;
+    int bytes_per_line = 0;
+
+    // Sequence number the next frame should have, and the frames lost so far
+    uint32_t next_sequence = 0;
+    bool sequence_known = false;
+    long skipped = 0;
+
+    // The Y bytes of YUYV frames
+    cv::Mat luma;
+
+    int control(uint32_t id, int *value, bool write);
+
+    bool requeue();
+
+    /*
+    The last frame with its pixels as they came from the driver
+    */
+    cv::Mat raw_view() const;
+};
+
+#endif // V4L2_CAPTURE_H_
@@ -25,6 +25,33 @@ VideoCapture::VideoCapture(INIReader& config_) : config(config_)
         }
     }
 
+    // Set the frame width and height if requested
+    // The frame width
+    fw = config.GetInteger("video", "frame_width", -1);
+    // The frame height
+    fh = config.GetInteger("video", "frame_height", -1);
+
+    // Play a recording back if the path is a file or a directory instead of a device
+    fs::file_status device = fs::status(config.Get("video", "device_path", ""));
+    if (fs::is_regular_file(device) || fs::is_directory(device))
+    {
+        replay_capture::pacing_type pacing = config.Get("video", "replay_pacing", "realtime") == "fast" ? replay_capture::fast : replay_capture::realtime;
+        open_replay(config.Get("video", "device_path", ""), pacing);
+        return;
+    }
+
+    // Read the luma straight from the driver's buffers if asked to
+    if (config.Get("video", "recording_plugin", "opencv") == "v4l2")
+    {
+        v4l2 = std::make_unique<v4l2_capture>();
+        if (!v4l2->open(config.Get("video", "device_path", ""), fw, fh))
+        {
+            syslog(LOG_ERR, "Failed to open the camera with the v4l2 recording plugin, aborting");
+            exit(1);
+        }
+        return;
+    }
+
     // Create reader
     // The internal video recorder
     // Start video capture on the IR camera through OpenCV
@@ -38,11 +65,6 @@ VideoCapture::VideoCapture(INIReader& config_) : config(config_)
         internal.set(cv::CAP_PROP_FOURCC, 1196444237);
     }
 
-    // Set the frame width and height if requested
-    // The frame width
-    fw = config.GetInteger("video", "frame_width", -1);
-    // The frame height
-    fh = config.GetInteger("video", "frame_height", -1);
     if (fw != -1)
         internal.set(cv::CAP_PROP_FRAME_WIDTH, fw);
     if (fh != -1)
@@ -52,12 +74,34 @@ VideoCapture::VideoCapture(INIReader& config_) : config(config_)
     internal.grab();
 }
 
+/*
+Plays the recording at path back instead of opening the camera in the
+config
+*/
+VideoCapture::VideoCapture(INIReader& config_, const std::string &path, replay_capture::pacing_type pacing) : config(config_)
+{
+    fw = config.GetInteger("video", "frame_width", -1);
+    fh = config.GetInteger("video", "frame_height", -1);
+    open_replay(path, pacing);
+}
+
+void VideoCapture::open_replay(const std::string &path, replay_capture::pacing_type pacing)
+{
+    replay = std::make_unique<replay_capture>();
+    if (!replay->open(path, pacing, config.GetReal("video", "replay_fps", 30)))
+    {
+        syslog(LOG_ERR, "Failed to open the recording at %s, aborting", path.c_str());
+        exit(1);
+    }
+    syslog(LOG_INFO, "Replaying a %s instead of reading a camera", replay->describe().c_str());
+}
+
 /*
 Frees resources when destroyed
 */
 VideoCapture::~VideoCapture()
 {
-    internal.release();
+    release();
 }
 
 /*
@@ -65,6 +109,10 @@ Release cameras
 */
 void VideoCapture::release()
 {
+    if (v4l2)
+        v4l2->release();
+    if (replay)
+        replay->release();
     internal.release();
 }
 
@@ -76,25 +124,82 @@ the frame in a tuple:
 
 If the grayscale conversion fails, both items in the tuple are identical.
 */
-void VideoCapture::read_frame(cv::Mat &frame, cv::Mat &gsframe)
+bool VideoCapture::read_frame(cv::Mat &frame, cv::Mat &gsframe)
+{
+    cv::Mat raw;
+    if (!read_raw(raw))
+        return false;
+
+    // The gray frame is read already, the color one is made from the same buffer
+    if (raw.channels() == 1)
+    {
+        raw.copyTo(gsframe);
+        read_color(frame);
+        return true;
+    }
+
+    frame = raw;
+    // Convert from color to grayscale
+    cv::cvtColor(frame, gsframe, cv::COLOR_BGR2GRAY);
+    return true;
+}
+
+/*
+Reads a frame as it comes from the camera, without converting it
+*/
+bool VideoCapture::read_raw(cv::Mat &frame)
 {
-    bool ret = internal.read(frame);
+    // The end of a recording is not an error
+    if (replay)
+    {
+        bool ret = replay->read(frame);
+        last = frame;
+        return ret;
+    }
+
+    bool ret = v4l2 ? v4l2->read(frame) : internal.read(frame);
+    last = frame;
     if (!ret)
     {
         syslog(LOG_ERR, "Failed to read camera specified in the 'device_path' config option, aborting");
         exit(1);
     }
+    return true;
+}
 
-    // Convert from color to grayscale
-    cv::cvtColor(frame, gsframe, cv::COLOR_BGR2GRAY);
+/*
+The frame of the last read_raw in BGR. Only converted if the camera
+did not deliver it that way.
+*/
+void VideoCapture::read_color(cv::Mat &frame)
+{
+    if (v4l2)
+        v4l2->color(frame);
+    else if (last.channels() == 1)
+        cv::cvtColor(last, frame, cv::COLOR_GRAY2BGR);
+    else
+        frame = last;
+}
+
+long VideoCapture::driver_drops()
+{
+    return v4l2 ? v4l2->dropped() : -1;
 }
 
 double VideoCapture::get(int propId)
 {
+    if (v4l2)
+        return v4l2->get(propId);
+    if (replay)
+        return replay->get(propId);
     return internal.get(propId);
 }
 
 bool VideoCapture::set(int propId, double value)
 {
+    if (v4l2)
+        return v4l2->set(propId, value);
+    if (replay)
+        return replay->set(propId, value);
     return internal.set(propId, value);
 }
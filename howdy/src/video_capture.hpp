@@ -1,12 +1,16 @@
 #ifndef VIDEO_CAPTURE_H_
 #define VIDEO_CAPTURE_H_
 
+#include <memory>
 #include <string>
 
 #include <opencv2/videoio.hpp>
 
 #include <INIReader.h>
 
+#include "replay_capture.hpp"
+#include "v4l2_capture.hpp"
+
 class VideoCapture
 {
 
@@ -17,6 +21,12 @@ public:
     */
     VideoCapture(INIReader& config_);
 
+    /*
+    Plays the recording at path back instead of opening the camera in the
+    config, see replay_capture
+    */
+    VideoCapture(INIReader& config_, const std::string &path, replay_capture::pacing_type pacing);
+
     /*
     Frees resources when destroyed
     */
@@ -34,8 +44,30 @@ public:
     (frame, grayscale_frame)
 
     If the grayscale conversion fails, both items in the tuple are identical.
+
+    Returns false once a recording being replayed has no frames left. A
+    camera that fails to deliver a frame still ends the process.
+    */
+    bool read_frame(cv::Mat &frame, cv::Mat &gsframe);
+
+    /*
+    Reads a frame as it comes from the camera, without converting it. With
+    the v4l2 recording plugin that is the gray luma of the frame, which is
+    only valid until the next read. Returns false like read_frame.
     */
-    void read_frame(cv::Mat &frame, cv::Mat &gsframe);
+    bool read_raw(cv::Mat &frame);
+
+    /*
+    The frame of the last read_raw in BGR. Only converted if the camera
+    did not deliver it that way.
+    */
+    void read_color(cv::Mat &frame);
+
+    /*
+    Frames the v4l2 recording plugin saw the driver drop, -1 for cameras
+    opened through OpenCV, which does not say
+    */
+    long driver_drops();
 
     double get(int propId);
 
@@ -47,6 +79,13 @@ public:
 private:
     INIReader& config;
     cv::VideoCapture internal;
+    // Set if the v4l2 recording plugin is used instead of OpenCV
+    std::unique_ptr<v4l2_capture> v4l2;
+    // Set if device_path is a recording instead of a camera
+    std::unique_ptr<replay_capture> replay;
+    cv::Mat last;
+
+    void open_replay(const std::string &path, replay_capture::pacing_type pacing);
 };
 
 #endif // VIDEO_CAPTURE_H_